@@ -0,0 +1,407 @@
+#include "common.h"
+#include "device.h"
+#include "keys.h"
+#include "latency.h"
+#include "mapper.h"
+#include "virtual_device.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using json = nlohmann::json;
+
+// every allocation of the process, so a benchmark can report allocations/event
+static uint64_t allocations = 0;
+
+// malloc/free back the replaced operators on purpose
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t n) {
+    allocations++;
+    if (void* p = malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static volatile uint64_t sink;
+
+static void set_time(input_event& e, uint64_t ns) {
+    e.time.tv_sec  = ns / 1000000000;
+    e.time.tv_usec = ns % 1000000000 / 1000;
+}
+
+// the key events of a typist, each one gap_ms after the one before
+struct Typist {
+    std::vector<input_event> events;
+    uint64_t ns = 0;
+
+    void key(uint code, int value, uint gap_ms) {
+        ns += uint64_t(gap_ms) * 1000000;
+        input_event e{};
+        e.type  = EV_KEY;
+        e.code  = code;
+        e.value = value;
+        set_time(e, ns);
+        events.push_back(e);
+    }
+};
+
+static uint code_of(const char* name) { return key_code(name); }
+
+static json basic_config() {
+    return json::parse(R"({"mapping": {
+        "EscAsGrave": {"enable": true, "type": "single", "from": "ESC", "to": "GRAVE"},
+        "CapsLock": {"enable": true, "type": "double", "key": "CAPSLOCK", "click": "ESC", "press": "LEFTCTRL"},
+        "Tab": {"enable": true, "type": "double", "key": "TAB", "click": "TAB", "press": "LEFTMETA"},
+        "SpaceFn": {"enable": true, "type": "meta", "key": "SPACE", "click": "SPACE",
+            "mapping": {"H": "LEFT", "J": "DOWN", "K": "UP", "L": "RIGHT", "BACKSPACE": "DELETE"}},
+        "Sig": {"enable": true, "type": "macro", "key": "F5", "steps": ["B", "Y", "E"]}
+    }, "autorepeat": {"delay": 250, "rate": 30, "keys": {"BACKSPACE": {"rate": 40}}}})");
+}
+
+// hundreds of mappings over the whole key table
+static json large_config() {
+    json cfg = basic_config();
+    auto& m  = cfg["mapping"];
+    std::vector<std::string> names;
+    for (uint code = 1; code < KEY_CNT; code++) {
+        auto name = key_name(code);
+        if (name && code != KEY_SPACE && code != KEY_CAPSLOCK && code != KEY_TAB) {
+            names.push_back(name);
+        }
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        m["single" + std::to_string(i)] = {
+            {"enable", true}, {"type", "single"}, {"from", names[i]}, {"to", names[names.size() - 1 - i]}};
+    }
+    for (size_t i = 0; i < 24; i++) {
+        m["double" + std::to_string(i)] = {{"enable", true},   {"type", "double"},
+                                           {"key", names[i * 7]}, {"click", names[i * 7]},
+                                           {"press", "LEFTSHIFT"}};
+    }
+    auto& meta = m["SpaceFn"]["mapping"];
+    for (size_t i = 0; i < 80; i++) {
+        meta[names[i * 3]] = names[i * 3 + 1];
+    }
+    // a stack of layers sharing keys with SpaceFn, every other one nested
+    for (size_t l = 0; l < 8; l++) {
+        auto name     = "layer" + std::to_string(l);
+        m[name]       = {{"enable", true}, {"type", "layer"}, {"key", "F" + std::to_string(13 + l)}};
+        auto& mapping = m[name]["mapping"];
+        for (size_t i = 0; i < 40; i++) {
+            mapping[names[(i + l) * 3]] = names[i * 5];
+        }
+        if (l % 2) {
+            m[name]["parent"] = "layer" + std::to_string(l - 1);
+        }
+    }
+    // chords of two and three keys, most of them sharing keys with others
+    for (size_t i = 0; i < 200; i++) {
+        auto keys = json::array({names[i], names[i + 1]});
+        if (i % 2) {
+            keys.push_back(names[i + 2]);
+        }
+        m["chord" + std::to_string(i)] = {
+            {"enable", true}, {"type", "chord"}, {"keys", keys}, {"to", names[names.size() - 1 - i]}};
+    }
+    return cfg;
+}
+
+static json chord_config() {
+    json cfg = basic_config();
+    auto& m  = cfg["mapping"];
+    m["JK"]  = {{"enable", true}, {"type", "chord"}, {"keys", {"J", "K"}}, {"to", "ESC"}};
+    m["SDF"] = {{"enable", true}, {"type", "chord"}, {"keys", {"S", "D", "F"}}, {"to", "TAB"}};
+    return cfg;
+}
+
+// about 100 words a minute, keys held 50 to 110ms
+static std::vector<input_event> typing(size_t n) {
+    const char* letters[] = {"A", "S", "D", "F", "G", "H", "J", "K", "L", "E", "R", "T", "U", "I", "O", "N"};
+    std::mt19937 rng(1);
+    Typist t;
+    while (t.events.size() < n) {
+        uint code = code_of(letters[rng() % 16]);
+        t.key(code, 1, 40 + rng() % 80);
+        t.key(code, 0, 50 + rng() % 60);
+    }
+    return t.events;
+}
+
+// double keys held while other keys and double keys roll over them
+static std::vector<input_event> rollover(size_t n) {
+    const char* letters[] = {"A", "S", "D", "F", "C", "V", "Z", "X"};
+    uint caps = code_of("CAPSLOCK"), tab = code_of("TAB");
+    std::mt19937 rng(2);
+    Typist t;
+    while (t.events.size() < n) {
+        uint a = code_of(letters[rng() % 8]), b = code_of(letters[rng() % 8]);
+        t.key(caps, 1, 150);
+        t.key(tab, 1, 40);
+        t.key(a, 1, 60);
+        // the repeat of the kernel, 250ms after the press
+        t.key(caps, 2, 150);
+        t.key(b, 1, 30);
+        t.key(caps, 0, 70);
+        t.key(a, 0, 20);
+        t.key(tab, 0, 40);
+        t.key(b, 0, 30);
+        // a plain tap, resolved as click
+        t.key(caps, 1, 120);
+        t.key(caps, 0, 80);
+    }
+    return t.events;
+}
+
+// SpaceFn: navigate with the layer held, then a plain space tap
+static std::vector<input_event> spacefn(size_t n) {
+    const char* nav[] = {"H", "J", "K", "L", "BACKSPACE"};
+    uint space        = code_of("SPACE");
+    std::mt19937 rng(3);
+    Typist t;
+    while (t.events.size() < n) {
+        t.key(space, 1, 150);
+        for (int i = 0; i < 4; i++) {
+            uint code = code_of(nav[rng() % 5]);
+            t.key(code, 1, 80);
+            t.key(code, 2, 250);
+            t.key(code, 0, 30);
+        }
+        t.key(space, 0, 60);
+        t.key(space, 1, 150);
+        t.key(space, 0, 70);
+    }
+    return t.events;
+}
+
+// chords, and typing over chord keys that have to be let go again
+static std::vector<input_event> chords(size_t n) {
+    const char* letters[] = {"S", "D", "F", "J", "K", "L", "A", "E"};
+    uint j = code_of("J"), k = code_of("K"), s = code_of("S"), d = code_of("D"), f = code_of("F");
+    std::mt19937 rng(4);
+    Typist t;
+    while (t.events.size() < n) {
+        // within the 50ms window of a chord
+        t.key(j, 1, 150);
+        t.key(k, 1, 10);
+        t.key(j, 0, 70);
+        t.key(k, 0, 10);
+        t.key(s, 1, 150);
+        t.key(d, 1, 8);
+        t.key(f, 1, 12);
+        t.key(f, 0, 80);
+        t.key(d, 0, 5);
+        t.key(s, 0, 7);
+        for (int i = 0; i < 4; i++) {
+            uint code = code_of(letters[rng() % 8]);
+            t.key(code, 1, 40 + rng() % 80);
+            t.key(code, 0, 50 + rng() % 60);
+        }
+    }
+    return t.events;
+}
+
+struct Result {
+    double ns_per_event;
+    double allocs_per_event;
+};
+
+// events again, a second after the last one, as the typist goes on
+static void next_pass(std::vector<input_event>& events, uint64_t span) {
+    for (auto& e : events) {
+        set_time(e, ns_of(e.time) + span);
+    }
+}
+
+// runs f over events until at least min_ns elapsed, after one warm-up pass,
+// each pass later than the one before
+template <typename F> static Result run(const std::vector<input_event>& events, F&& f) {
+    constexpr uint64_t min_ns = 200000000;
+    uint64_t span             = ns_of(events.back().time) + 1000000000;
+    auto pass                 = events;
+    for (auto& e : pass) {
+        f(e);
+    }
+    uint64_t n = 0, allocs = allocations, elapsed = 0;
+    while (elapsed < min_ns) {
+        next_pass(pass, span);
+        uint64_t begin = now_ns();
+        for (auto& e : pass) {
+            f(e);
+        }
+        elapsed += now_ns() - begin;
+        n += pass.size();
+    }
+    return {double(elapsed) / n, double(allocations - allocs) / n};
+}
+
+// what the deadline timer of a stage would have sent before an event at now
+template <typename M> static void expire_until(M& m, uint64_t now, Events& out) {
+    while (uint64_t d = m.deadline()) {
+        if (d > now) {
+            break;
+        }
+        if constexpr (requires { m.expire(d, out); }) {
+            m.expire(d, out);
+        } else {
+            m.expire(out);
+        }
+    }
+}
+
+// the deadlines of the pipeline due before e, then e, as lanmai maps it
+static size_t feed(Pipeline& pipeline, const input_event& e) {
+    size_t n = 0;
+    while (uint64_t d = pipeline.deadline()) {
+        if (d > ns_of(e.time)) {
+            break;
+        }
+        n += pipeline.expire(d).size();
+    }
+    return n + pipeline.map(e).size();
+}
+
+// the whole event path of lanmai, from the events a Device reads to the
+// frames its VirtualDevice writes, to fd instead of uinput
+struct Lanmai {
+    EventLoop loop;
+    VirtualDevice vdev;
+    Device device;
+
+    Lanmai(const json& cfg, int fd) : vdev(loop, {get_mappers(cfg)}), device(loop, "lanmai_bench", vdev, 0) {
+        vdev.open(fd);
+    }
+    // e in a frame of its own, after the deadlines due before it
+    void feed(const input_event& e) {
+        while (uint64_t d = vdev.deadline()) {
+            if (d > ns_of(e.time)) {
+                break;
+            }
+            vdev.expire(d);
+        }
+        input_event frame[2] = {e, {}};
+        frame[1].time        = e.time;
+        frame[1].type        = EV_SYN;
+        frame[1].code        = SYN_REPORT;
+        device.handle_events(frame, 2);
+    }
+};
+
+struct Workload {
+    const char* name;
+    json cfg;
+    std::vector<input_event> events;
+};
+
+// allocations of f over a pass of events, after a warm-up pass
+template <typename F> static uint64_t count_allocations(const std::vector<input_event>& events, F&& f) {
+    uint64_t span = ns_of(events.back().time) + 1000000000;
+    auto pass     = events;
+    for (auto& e : pass) {
+        f(e);
+    }
+    next_pass(pass, span);
+    uint64_t allocs = allocations;
+    for (auto& e : pass) {
+        f(e);
+    }
+    return allocations - allocs;
+}
+
+// the event path must not allocate once it's warmed up, `lanmai_bench --check`
+// fails if it does, ctest runs it. The mapper chain, and all lanmai does with
+// the events of a device up to the write of its frames, to /dev/null.
+static int check_allocations(const std::vector<Workload>& workloads) {
+    int res     = 0;
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    auto report = [&](const char* workload, const char* stage, uint64_t allocs, size_t events) {
+        printf("%-16s %-10s %8lu allocations in %zu events\n", workload, stage, allocs, events);
+        if (allocs) {
+            res = 1;
+        }
+    };
+    for (auto& w : workloads) {
+        Pipeline pipeline(get_mappers(w.cfg));
+        report(w.name, "chain",
+               count_allocations(w.events, [&](const input_event& e) { sink = sink + feed(pipeline, e); }),
+               w.events.size());
+        Lanmai lanmai(w.cfg, devnull);
+        report(w.name, "device", count_allocations(w.events, [&](const input_event& e) { lanmai.feed(e); }),
+               w.events.size());
+    }
+    close(devnull);
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    constexpr size_t EVENTS = 1 << 16;
+    bool check              = argc > 1 && std::string(argv[1]) == "--check";
+    std::vector<Workload> workloads = {
+        {"typing", basic_config(), typing(EVENTS)},
+        {"rollover", basic_config(), rollover(EVENTS)},
+        {"spacefn", basic_config(), spacefn(EVENTS)},
+        {"chords", chord_config(), chords(EVENTS)},
+        {"typing-large", large_config(), typing(EVENTS)},
+        {"rollover-large", large_config(), rollover(EVENTS)},
+        {"spacefn-large", large_config(), spacefn(EVENTS)},
+        {"chords-large", large_config(), chords(EVENTS)},
+    };
+    if (check) {
+        return check_allocations(workloads);
+    }
+
+    printf("%-16s %-10s %12s %14s\n", "workload", "stage", "ns/event", "allocs/event");
+    auto report = [](const char* workload, const char* stage, Result r) {
+        printf("%-16s %-10s %12.2f %14.4f\n", workload, stage, r.ns_per_event, r.allocs_per_event);
+    };
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    for (auto& w : workloads) {
+        auto [sm, cm, dm, lm, mm, rm] = get_mappers(w.cfg);
+        Events out;
+
+        report(w.name, "single", run(w.events, [&](const input_event& e) { sink = sink + sm.map(e).code; }));
+        report(w.name, "chord", run(w.events, [&](const input_event& e) {
+                   out.clear();
+                   expire_until(cm, ns_of(e.time), out);
+                   cm.map(e, out);
+                   sink = sink + out.size();
+               }));
+        report(w.name, "double", run(w.events, [&](const input_event& e) {
+                   out.clear();
+                   expire_until(dm, ns_of(e.time), out);
+                   dm.map(e, out);
+                   sink = sink + out.size();
+               }));
+        report(w.name, "layer", run(w.events, [&](const input_event& e) {
+                   out.clear();
+                   lm.map(e, out);
+                   sink = sink + out.size();
+               }));
+        report(w.name, "macro", run(w.events, [&](const input_event& e) {
+                   out.clear();
+                   expire_until(mm, ns_of(e.time), out);
+                   mm.map(e, out);
+                   sink = sink + out.size();
+               }));
+        report(w.name, "repeat", run(w.events, [&](const input_event& e) {
+                   out.clear();
+                   expire_until(rm, ns_of(e.time), out);
+                   rm.map(e, out);
+                   sink = sink + out.size();
+               }));
+        Pipeline pipeline(get_mappers(w.cfg));
+        report(w.name, "chain", run(w.events, [&](const input_event& e) { sink = sink + feed(pipeline, e); }));
+        Lanmai lanmai(w.cfg, devnull);
+        report(w.name, "device", run(w.events, [&](const input_event& e) { lanmai.feed(e); }));
+    }
+    close(devnull);
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include "latency.h"
+#include "third_party/argparse.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Types through a running lanmai and reads the keys back from its virtual
+// keyboard: a uinput keyboard is created, lanmai is started on it alone with
+// an empty mapping, and every key event written to it is timed until it comes
+// out. Prints the latencies and the CPU time lanmai used per event, e.g. to
+// compare plain reads and writes with --io-uring. Needs root.
+
+static constexpr const char* VIRTUAL_NAME = "lanmai virtual keyboard";
+// not bound to anything, the probes sent before the grab go to the session
+static constexpr uint KEY = KEY_F24;
+
+static std::vector<std::string> virtual_nodes() {
+    std::vector<std::string> res;
+    for (auto& entry : std::filesystem::directory_iterator("/dev/input")) {
+        auto path = entry.path().string();
+        if (entry.path().filename().string().rfind("event", 0) != 0) {
+            continue;
+        }
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        char name[256] = {};
+        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+        close(fd);
+        if (strcmp(name, VIRTUAL_NAME) == 0) {
+            res.push_back(path);
+        }
+    }
+    return res;
+}
+
+// waits at most timeout_ms for a key event of KEY with value on fd
+static bool read_key(int fd, int value, int timeout_ms) {
+    uint64_t deadline = now_ns() + uint64_t(timeout_ms) * 1000000;
+    while (true) {
+        input_event e;
+        while (read(fd, &e, sizeof(e)) == sizeof(e)) {
+            if (e.type == EV_KEY && e.code == KEY && e.value == value) {
+                return true;
+            }
+        }
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            return false;
+        }
+        pollfd pfd{fd, POLLIN, 0};
+        poll(&pfd, 1, int((deadline - now) / 1000000) + 1);
+    }
+}
+
+static void send_key(libevdev_uinput* src, int value) {
+    libevdev_uinput_write_event(src, EV_KEY, KEY, value);
+    libevdev_uinput_write_event(src, EV_SYN, SYN_REPORT, 0);
+}
+
+// user and system time of the process, all its threads
+static uint64_t cpu_ns(pid_t pid) {
+    FILE* f = fopen(("/proc/" + std::to_string(pid) + "/stat").c_str(), "r");
+    if (!f) {
+        return 0;
+    }
+    char line[1024] = {};
+    fgets(line, sizeof(line), f);
+    fclose(f);
+    // the fields after the command name, which may hold spaces
+    const char* rest = strrchr(line, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!rest || sscanf(rest + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return 0;
+    }
+    return uint64_t(utime + stime) * 1000000000 / sysconf(_SC_CLK_TCK);
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser parser("lanmai_loopback_bench");
+
+    parser.add_argument("--lanmai").help("lanmai binary, default: ./lanmai").default_value(std::string("./lanmai"));
+    parser.add_argument("-n", "--events")
+        .help("key events to send, default: 20000")
+        .default_value(20000)
+        .scan<'i', int>();
+    parser.add_argument("--interval")
+        .help("us between two events, default: 500")
+        .default_value(500)
+        .scan<'i', int>();
+    parser.add_argument("--io-uring")
+        .help("run lanmai with --io-uring")
+        .default_value(false)
+        .implicit_value(true);
+
+    try {
+        parser.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        printf("%s\n", err.what());
+        printf("%s\n", parser.help().str().c_str());
+        exit(1);
+    }
+    int events   = parser.get<int>("-n");
+    int interval = parser.get<int>("--interval");
+    bool uring   = parser.get<bool>("--io-uring");
+
+    libevdev* dev = libevdev_new();
+    libevdev_set_name(dev, "lanmai loopback bench");
+    for (uint code = KEY_ESC; code <= KEY_F24; code++) {
+        libevdev_enable_event_code(dev, EV_KEY, code, nullptr);
+    }
+    libevdev_uinput* src = nullptr;
+    if (int err = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &src); err < 0) {
+        printf("can't create the source device, %s\n", strerror(-err));
+        return 1;
+    }
+    char config[] = "/tmp/lanmai-bench-XXXXXX";
+    int cfd       = mkstemp(config);
+    if (cfd < 0 || write(cfd, "{\"mapping\": {}}\n", 16) != 16) {
+        printf("can't write the config\n");
+        return 1;
+    }
+    close(cfd);
+
+    auto before = virtual_nodes();
+    pid_t pid   = fork();
+    if (pid == 0) {
+        auto lanmai = parser.get<std::string>("--lanmai");
+        std::vector<const char*> args = {lanmai.c_str(), "-c", config, "-d", libevdev_uinput_get_devnode(src)};
+        if (uring) {
+            args.push_back("--io-uring");
+        }
+        args.push_back(nullptr);
+        execv(args[0], const_cast<char* const*>(args.data()));
+        printf("can't run %s, %s\n", args[0], strerror(errno));
+        _exit(1);
+    }
+
+    // the virtual keyboard of this lanmai, another one may run
+    int vfd = -1;
+    for (int i = 0; i < 100 && vfd < 0; i++) {
+        usleep(50000);
+        for (auto& node : virtual_nodes()) {
+            if (std::find(before.begin(), before.end(), node) == before.end()) {
+                vfd = open(node.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            }
+        }
+    }
+    int rc = 1;
+    if (vfd < 0) {
+        printf("lanmai didn't create its virtual keyboard\n");
+    } else {
+        // what comes out goes nowhere else
+        ioctl(vfd, EVIOCGRAB, 1);
+        // it comes out once the source is grabbed
+        bool grabbed = false;
+        for (int i = 0; i < 50 && !grabbed; i++) {
+            send_key(src, 1);
+            send_key(src, 0);
+            grabbed = read_key(vfd, 0, 100);
+        }
+        if (!grabbed) {
+            printf("lanmai didn't grab the source device\n");
+        } else {
+            Histogram latency;
+            int lost       = 0;
+            uint64_t cpu   = cpu_ns(pid);
+            uint64_t begin = now_ns();
+            for (int i = 0; i < events; i++) {
+                int value      = i % 2 == 0;
+                uint64_t start = now_ns();
+                send_key(src, value);
+                if (read_key(vfd, value, 1000)) {
+                    latency.record(start, now_ns());
+                } else {
+                    lost++;
+                }
+                usleep(interval);
+            }
+            double secs = (now_ns() - begin) / 1e9;
+            cpu         = cpu_ns(pid) - cpu;
+            printf("%d key events in %.2f s, io_uring: %s, %d lost\n", events, secs, uring ? "yes" : "no", lost);
+            printf("latency us: p50 %.1f, p99 %.1f, p99.9 %.1f\n", latency.quantile(0.5) / 1e3,
+                   latency.quantile(0.99) / 1e3, latency.quantile(0.999) / 1e3);
+            printf("lanmai cpu: %.1f ms, %.2f us/event\n", cpu / 1e6, cpu / 1e3 / events);
+            rc = lost ? 1 : 0;
+        }
+        close(vfd);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    unlink(config);
+    libevdev_uinput_destroy(src);
+    libevdev_free(dev);
+    return rc;
+}
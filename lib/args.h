@@ -7,5 +7,12 @@ struct Args {
     std::string config_path;
     int8_t log_level;
     std::string device;
+    std::string latency_file;
+    std::string record_file;
+    std::string rt_policy;
+    int rt_priority = -1;
+    bool lock_memory;
+    std::string cpus;
+    bool io_uring;
     Args(int argc, char* argv[]);
 };
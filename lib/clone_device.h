@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "output.h"
+#include "uring.h"
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <optional>
+
+// mouse, joystick, gamepad and tablet buttons, a device with them looks like one
+inline bool is_button(uint code) { return code >= BTN_MISC && code < KEY_OK; }
+
+// A uinput copy of a grabbed device with a pointer, e.g. the touchpad of a
+// keyboard, its events the virtual keyboard doesn't take are passed on
+// through it, the way lanmai did for every device before.
+class CloneDevice {
+  public:
+    explicit CloneDevice(Uring* uring) : uring(uring) {}
+    ~CloneDevice();
+    CloneDevice(const CloneDevice&)            = delete;
+    CloneDevice& operator=(const CloneDevice&) = delete;
+
+    // whether the evdev device fd has relative or absolute axes, or buttons
+    static bool needed(int fd);
+    // creates the copy of fd
+    bool open(int fd);
+    void push(const input_event& e) { output->push(e); }
+    // writes the current frame, returns false if it was empty
+    bool flush() { return output->flush(); }
+
+  private:
+    libevdev* dev          = nullptr;
+    int uifd               = -1;
+    libevdev_uinput* uidev = nullptr;
+    std::optional<Output> output;
+    Uring* uring;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "keymap.h"
+#include "mapper.h"
+#include "profile.h"
+#include "realtime.h"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Everything lanmai takes from the config file but the keymaps, compiled. It
+// is trivially copyable so it can be written to the cache as it is and used
+// from a mapping of the cache file, the keymaps follow it there.
+struct CompiledConfig {
+    RtOptions realtime;
+    uint8_t profile_cnt = 0;
+    std::array<ProfileMatch, ProfileMatch::MAX_PROFILES> profiles{};
+};
+
+// A loaded config, its parts may point into the cache mapping.
+struct Config {
+    std::shared_ptr<const CompiledConfig> compiled;
+    // keymaps[0] for the devices no profile matches, keymaps[i + 1] for profile i
+    std::vector<std::shared_ptr<const Keymap>> keymaps;
+
+    // the keymap of the first profile matching the device, -1 if it's excluded
+    int keymap_of(const DeviceId& id) const;
+    // the profiles match the same devices in both
+    bool same_profiles(const Config& other) const;
+    // mappers of each keymap
+    std::vector<Mappers> mappers() const;
+};
+
+std::string cache_path(const std::string& config_path);
+// The compiled config from the cache next to it, <config>.cache, when it was
+// made from the config as it is now. Otherwise the config is parsed, compiled
+// and written to the cache for the next time. Throws like readConfig and
+// compile_keymap for an invalid config.
+Config load_config(const std::string& config_path);
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "clone_device.h"
+#include "config_cache.h"
+#include "event_loop.h"
+#include "latency.h"
+#include "mapper.h"
+#include "record.h"
+#include "virtual_device.h"
+#include <bitset>
+#include <functional>
+#include <linux/input.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A keyboard lanmai grabs, its events go through the mappers of its keymap,
+// shared with the other devices of it, to the VirtualDevice. All of it runs on
+// the EventLoop thread.
+class Device {
+  public:
+    Device(EventLoop& loop, std::string path, VirtualDevice& vdev, uint keymap, Recorder* recorder = nullptr,
+           uint8_t id = 0);
+    ~Device();
+    Device(const Device&)            = delete;
+    Device& operator=(const Device&) = delete;
+
+    // opens the device, it's grabbed as soon as no key is held
+    bool open();
+    // releases everything the device holds, keys included, it can't be used anymore
+    void close();
+    bool closed() const { return fd < 0; }
+    // called when it closes, e.g. on a read error, it may not be destroyed from cb
+    void on_close(std::function<void()> cb) { closed_cb = std::move(cb); }
+    const std::string& path() const { return dev_path; }
+    const LatencyStats& latency() const { return stats; }
+    // maps events read from the device, lanmai_bench calls it without one
+    void handle_events(const input_event* events, size_t n);
+
+  private:
+    std::bitset<KEY_CNT> keys_down() const;
+    void try_grab(bool force);
+    // sends a release of each key of keys from the device, to everyone else
+    void release_held(const std::bitset<KEY_CNT>& keys);
+    void handle_input(uint32_t events);
+    // a read of uring is done, res bytes or -errno
+    void handle_read(int res, const char* data);
+    // reads all queued events, map them or drop them
+    void read_events(bool map);
+    void handle_event(const input_event& input);
+    void handle_key(const input_event& input);
+    void resync();
+    void release_keys();
+
+    EventLoop& loop;
+    std::string dev_path;
+    int fd       = -1;
+    bool grabbed = false;
+    // posted instead of the fd being in the loop, with io_uring
+    Uring::ReadOp* read_op = nullptr;
+    // a SYN_DROPPED was read, the rest of its frame is dropped
+    bool dropping = false;
+    VirtualDevice& vdev;
+    // the events of its axes and buttons, for a device with a pointer
+    std::unique_ptr<CloneDevice> clone;
+    uint keymap;
+    Timer grab_timer;
+    // keys held when the device was grabbed, a forced grab releases them
+    // first, only those it couldn't are left
+    std::bitset<KEY_CNT> held_at_grab;
+
+    // keys held on the device, as the pipeline saw them
+    std::bitset<KEY_CNT> down;
+    // raw events are recorded when it is set
+    Recorder* recorder;
+    uint8_t id;
+
+    LatencyStats stats;
+    // a new frame starts with the next event
+    bool frame_start = true;
+    std::function<void()> closed_cb;
+};
+
+// All grabbed devices, keyed by devnode, and the virtual device they share.
+class DeviceTable {
+  public:
+    DeviceTable(EventLoop& loop, const Config& config, Recorder* recorder = nullptr);
+    // closes every device, they ungrab and release their keys, then the virtual device
+    ~DeviceTable();
+    DeviceTable(const DeviceTable&)            = delete;
+    DeviceTable& operator=(const DeviceTable&) = delete;
+    // creates the virtual device, before any device is added
+    bool open() { return vdev.open(); }
+    // opens the device with the keymap of its profile, unless it's in the
+    // table already or its profile excludes it
+    void add(const DeviceId& id);
+    // closes path and drops it from the table
+    void remove(const std::string& path);
+    // switches to config once no key is held on any device. When the profiles
+    // changed, all devices are closed and have to be added again, it returns
+    // false then.
+    bool reload(const Config& config);
+    // latency histograms of every device
+    nlohmann::json latency() const;
+
+  private:
+    // frees the devices that closed themselves
+    void reap();
+
+    EventLoop& loop;
+    // eventfd, readable once a device closed itself
+    int reap_fd;
+    Config config;
+    // declared before devices, they release their keys through it when destroyed
+    VirtualDevice vdev;
+    Recorder* recorder;
+    // ids devices are recorded with
+    uint8_t next_id = 0;
+    std::vector<std::unique_ptr<Device>> devices;
+};
@@ -4,5 +4,10 @@ enum ErrCode : int {
     // IO
     OPEN_FILE_ERROR = 0x0,
     // Config
-    PARSE_JSON_ERROR = 0x100,
+    PARSE_JSON_ERROR  = 0x100,
+    UNKNOWN_KEY_ERROR = 0x101,
+    LAYER_ERROR       = 0x102,
+    CHORD_ERROR       = 0x103,
+    MACRO_ERROR       = 0x104,
+    PROFILE_ERROR     = 0x105,
 };
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "uring.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
+
+// Single-threaded epoll reactor, runs the callback registered for a fd each
+// time it becomes ready.
+class EventLoop {
+  public:
+    using Callback = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&)            = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool add(int fd, Callback cb, uint32_t events = EPOLLIN);
+    void remove(int fd);
+    // dispatches ready fds until stop() is called
+    void run();
+    void stop() { running = false; }
+    // device reads and uinput writes go through io_uring from now on, false
+    // if it's unavailable, they stay plain reads and writes then
+    bool use_io_uring();
+    // nullptr for plain reads and writes
+    Uring* uring() const { return io.get(); }
+
+  private:
+    struct Handler {
+        int fd;
+        Callback cb;
+    };
+    int epfd;
+    bool running = false;
+    std::unordered_map<int, std::unique_ptr<Handler>> handlers;
+    // handlers removed while dispatching, freed after the batch
+    std::vector<std::unique_ptr<Handler>> removed;
+    // after the handlers, it removes its own on destruction
+    std::unique_ptr<Uring> io;
+};
+
+// One-shot CLOCK_MONOTONIC timerfd dispatched by an EventLoop.
+class Timer {
+  public:
+    Timer(EventLoop& loop, std::function<void()> cb);
+    ~Timer();
+    Timer(const Timer&)            = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    void arm(std::chrono::nanoseconds after);
+    // fires at the CLOCK_MONOTONIC time at_ns
+    void arm_at(uint64_t at_ns);
+    void disarm();
+    bool armed() const { return is_armed; }
+
+  private:
+    EventLoop& loop;
+    int fd;
+    bool is_armed = false;
+    std::function<void()> cb;
+};
@@ -1,3 +1,34 @@
 #pragma once
 
-bool have_new_device();
+#include "config_cache.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Watches the config file from a background thread. Every time it changes, it
+// is parsed and compiled there, and the event loop picks the new config up
+// through ready_fd() and take(). An invalid config is logged and skipped.
+class ConfigWatcher {
+  public:
+    explicit ConfigWatcher(std::string path);
+    ~ConfigWatcher();
+    ConfigWatcher(const ConfigWatcher&)            = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    // eventfd, readable when a new config is ready
+    int ready_fd() const { return readyfd; }
+    // the newest config compiled since the last call, nullptr if none
+    std::unique_ptr<Config> take();
+
+  private:
+    void run();
+    void reload();
+
+    std::string path;
+    int inotfd;
+    int stopfd;
+    int readyfd;
+    std::atomic<Config*> pending{nullptr};
+    std::thread thread;
+};
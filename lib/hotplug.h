@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include <functional>
+#include <string>
+
+struct HotplugEvent {
+    bool added;
+    bool keyboard;
+    DeviceId id;
+};
+
+// Persistent udev netlink monitor on the "input" subsystem, it reports the
+// input nodes added or removed since the last receive().
+class HotplugMonitor {
+  public:
+    HotplugMonitor();
+    ~HotplugMonitor();
+    HotplugMonitor(const HotplugMonitor&)            = delete;
+    HotplugMonitor& operator=(const HotplugMonitor&) = delete;
+
+    // non-blocking, readable when events are pending
+    int fd() const { return monitor_fd; }
+    void receive(const std::function<void(const HotplugEvent&)>& cb);
+
+  private:
+    struct udev* udev;
+    struct udev_monitor* monitor;
+    int monitor_fd;
+};
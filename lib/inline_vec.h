@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Fixed-capacity vector with inline storage, used on the event path where a
+// heap allocation per event is not acceptable. Pushing into a full vector drops
+// the element and returns false.
+template <typename T, size_t N> class InlineVec {
+  public:
+    using value_type = T;
+
+    bool push_back(const T& v) {
+        if (n == N) {
+            return false;
+        }
+        buf[n++] = v;
+        return true;
+    }
+    void erase(size_t i) {
+        for (; i + 1 < n; i++) {
+            buf[i] = buf[i + 1];
+        }
+        n--;
+    }
+    void clear() { n = 0; }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    bool full() const { return n == N; }
+    static constexpr size_t capacity() { return N; }
+
+    T* data() { return buf.data(); }
+    const T* data() const { return buf.data(); }
+    T& operator[](size_t i) { return buf[i]; }
+    const T& operator[](size_t i) const { return buf[i]; }
+    T* begin() { return buf.data(); }
+    T* end() { return buf.data() + n; }
+    const T* begin() const { return buf.data(); }
+    const T* end() const { return buf.data() + n; }
+
+  private:
+    std::array<T, N> buf;
+    size_t n = 0;
+};
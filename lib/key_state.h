@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <linux/input.h>
+
+// The keys pressed on an output, a bit per key code. A press of a key already
+// down, or a release or repeat of a key that isn't, is redundant, Output and
+// lanmai-replay drop it.
+class KeyState {
+  public:
+    // updates the state with e, false if e is redundant
+    bool apply(const input_event& e) {
+        if (e.type != EV_KEY || e.code >= KEY_CNT) {
+            return true;
+        }
+        uint64_t& word = down[e.code / 64];
+        uint64_t bit   = uint64_t(1) << (e.code % 64);
+        if (e.value == 1 ? word & bit : !(word & bit)) {
+            return false;
+        }
+        if (e.value == 1) {
+            word |= bit;
+        } else if (e.value == 0) {
+            word &= ~bit;
+        }
+        return true;
+    }
+    bool test(uint code) const { return code < KEY_CNT && down[code / 64] >> (code % 64) & 1; }
+    bool any() const {
+        return std::any_of(down.begin(), down.end(), [](uint64_t word) { return word != 0; });
+    }
+    // calls f with each key down, lowest code first
+    template <typename F> void for_each(F f) const {
+        for (size_t i = 0; i < down.size(); i++) {
+            for (uint64_t word = down[i]; word; word &= word - 1) {
+                f(uint(i * 64 + std::countr_zero(word)));
+            }
+        }
+    }
+
+  private:
+    std::array<uint64_t, (KEY_CNT + 63) / 64> down{};
+};
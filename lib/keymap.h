@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common.h"
+#include "third_party/json.hpp"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <linux/input.h>
+
+// All mappings of a config compiled into dense tables indexed by key code, so
+// the mappers resolve every event with a few indexed loads.
+struct Keymap {
+    enum Role : uint8_t {
+        ROLE_NONE   = 0,
+        ROLE_SINGLE = 1 << 0,
+        ROLE_DOUBLE = 1 << 1,
+        ROLE_CHORD  = 1 << 2,
+        ROLE_MACRO  = 1 << 3,
+    };
+    static constexpr uint MAX_CHORDS     = 256;
+    static constexpr uint MAX_CHORD_KEYS = 8;
+
+    struct Chord {
+        uint16_t to;
+        uint8_t size;
+    };
+
+    // layer 0 is the base layer, always active, it only holds the keys of the
+    // top level layers. A key resolves in the highest active layer mapping it,
+    // nested layers come after their parent so they take precedence.
+    static constexpr uint MAX_LAYERS = 16;
+    // a layer_map entry is a key code, or LAYER_KEY | layer for a layer key
+    static constexpr uint16_t LAYER_KEY = 0x8000;
+
+    struct Layer {
+        // the layer holding its key, the layer only works while it is active
+        uint8_t parent;
+        // toggled by a press instead of being active while held
+        bool toggle;
+        // momentary only, sent when the key is released before any other press
+        bool has_click;
+        uint16_t click;
+    };
+
+    static constexpr uint MAX_MACROS      = 64;
+    static constexpr uint MAX_MACRO_STEPS = 1024;
+
+    struct MacroStep {
+        enum Kind : uint8_t { RELEASE = 0, PRESS = 1, DELAY = 2 };
+        uint8_t kind;
+        uint16_t code;
+        uint16_t delay_ms;
+    };
+    struct Macro {
+        // its steps in macro_steps
+        uint16_t first;
+        uint16_t count;
+        // ms between two events it sends
+        uint16_t pace_ms;
+    };
+
+    std::array<uint8_t, KEY_CNT> role{};
+    // SingleMapper target, identity for unmapped keys
+    std::array<uint16_t, KEY_CNT> single{};
+    // DoubleMapper targets
+    std::array<uint16_t, KEY_CNT> click{};
+    std::array<uint16_t, KEY_CNT> press{};
+    // ms a double key may be held alone before it resolves as press, 0 for no limit
+    std::array<uint16_t, KEY_CNT> hold_ms{};
+    // ChordMapper index, bit n is set when chord n has the key, or has n keys
+    std::array<std::bitset<MAX_CHORDS>, KEY_CNT> chord_mask{};
+    std::array<std::bitset<MAX_CHORDS>, MAX_CHORD_KEYS + 1> chord_size{};
+    std::array<Chord, MAX_CHORDS> chords{};
+    // the longest window, in ms from its press, of the chords having the key
+    std::array<uint16_t, KEY_CNT> chord_window{};
+    uint16_t chord_cnt = 0;
+    // LayerMapper targets per layer, bit n of layer_mask is set when layer n maps the key
+    std::array<std::array<uint16_t, KEY_CNT>, MAX_LAYERS> layer_map{};
+    std::array<uint16_t, KEY_CNT> layer_mask{};
+    std::array<Layer, MAX_LAYERS> layers{};
+    uint8_t layer_cnt = 1;
+    // MacroMapper macros, started by pressing their key
+    std::array<uint8_t, KEY_CNT> macro_of{};
+    std::array<Macro, MAX_MACROS> macros{};
+    std::array<MacroStep, MAX_MACRO_STEPS> macro_steps{};
+    uint16_t macro_cnt      = 0;
+    uint16_t macro_step_cnt = 0;
+    // RepeatMapper, per key sent: ms from its press to the first repeat, and
+    // repeats per second after it, 0 when lanmai doesn't repeat it
+    std::array<uint16_t, KEY_CNT> repeat_delay_ms{};
+    std::array<uint16_t, KEY_CNT> repeat_rate{};
+
+    Keymap() {
+        for (uint code = 0; code < KEY_CNT; code++) {
+            single[code] = code;
+        }
+    }
+
+    uint8_t role_of(uint code) const { return code < KEY_CNT ? role[code] : uint8_t(ROLE_NONE); }
+    bool is(uint code, Role r) const { return role_of(code) & r; }
+    uint single_of(uint code) const { return code < KEY_CNT ? single[code] : code; }
+    bool repeats(uint code) const { return code < KEY_CNT && repeat_rate[code]; }
+};
+
+Keymap compile_keymap(const nlohmann::json& cfg);
+// the tables only index each other within their bounds and send key codes, as
+// compile_keymap makes them, for a keymap read from elsewhere, e.g. the cache
+bool check_keymap(const Keymap& km);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "third_party/json.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <sys/time.h>
+
+inline uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+inline uint64_t ns_of(const timeval& tv) { return uint64_t(tv.tv_sec) * 1000000000 + uint64_t(tv.tv_usec) * 1000; }
+
+// Log-linear histogram of nanosecond latencies with fixed buckets, HDR-style:
+// 8 sub-buckets per power of two, so a value is kept within 12.5%. It has a
+// single writer, readers on any thread get a consistent enough view without
+// any lock.
+class Histogram {
+  public:
+    static constexpr int SUB_BITS   = 3;
+    static constexpr uint64_t SUB   = 1 << SUB_BITS;
+    static constexpr size_t BUCKETS = 64 * SUB;
+
+    void record(uint64_t ns) {
+        auto& c = counts[bucket(ns)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    // the same as record(end - begin), clocks going backwards count as 0
+    void record(uint64_t begin, uint64_t end) { record(end > begin ? end - begin : 0); }
+
+    uint64_t count() const;
+    // upper bound of the bucket holding the p-th quantile, 0 <= p <= 1
+    uint64_t quantile(double p) const;
+    nlohmann::json to_json() const;
+
+    static size_t bucket(uint64_t v) {
+        if (v < SUB) {
+            return v;
+        }
+        int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        return (size_t(shift + 1) << SUB_BITS) + ((v >> shift) & (SUB - 1));
+    }
+    static uint64_t bucket_high(size_t idx) {
+        if (idx < SUB) {
+            return idx;
+        }
+        int shift = int(idx >> SUB_BITS) - 1;
+        return ((SUB + (idx & (SUB - 1))) << shift) + ((uint64_t(1) << shift) - 1);
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+};
+
+// Latencies of one grabbed device, per pipeline stage.
+struct LatencyStats {
+    // kernel timestamp to the start of handling its frame
+    Histogram read;
+    // the mapper chain, per key event
+    Histogram map;
+    // the write() of one frame to uinput
+    Histogram write;
+    // kernel timestamp of the frame end to its write() done
+    Histogram total;
+
+    nlohmann::json to_json() const;
+};
@@ -1,11 +1,25 @@
 #pragma once
 
-#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
 
 inline int8_t GLOBAL_LOG_LEVEL = 0;
 enum LogLevel : int8_t { LL_ERROR = 0, LL_INFO = 1, LL_DEBUG = 2 };
 
-inline std::string ll_name(LogLevel log_level) {
+// calls above this level are compiled out, release builds drop DEBUG
+#ifndef LANMAI_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define LANMAI_MIN_LOG_LEVEL LL_INFO
+#else
+#define LANMAI_MIN_LOG_LEVEL LL_DEBUG
+#endif
+#endif
+
+constexpr const char* ll_name(LogLevel log_level) {
     switch (log_level) {
     case LL_ERROR:
         return "ERROR";
@@ -18,11 +32,122 @@ inline std::string ll_name(LogLevel log_level) {
     }
 }
 
-#define LLOG(log_level, fmt, args...)                                                                 \
-    do {                                                                                              \
-        if (log_level <= GLOBAL_LOG_LEVEL) {                                                          \
-            printf("[%s:%d, %s][%s] ", __FILE__, __LINE__, __FUNCTION__, ll_name(log_level).c_str()); \
-            printf(fmt, ##args);                                                                      \
-            printf("\n");                                                                             \
-        }                                                                                             \
+// Where a LLOG call is, the format id of its records.
+struct LogSite {
+    const char* file;
+    int line;
+    const char* function;
+    LogLevel level;
+    const char* fmt;
+};
+
+constexpr size_t LOG_PAYLOAD = 480;
+// string arguments are copied and truncated to this, they may not outlive the call
+constexpr size_t LOG_STR_MAX = 224;
+
+struct LogRecord {
+    const LogSite* site;
+    void (*format)(FILE* out, const LogSite* site, const char* payload);
+    char payload[LOG_PAYLOAD];
+};
+
+// The records go through a lock-free MPSC ring and are formatted by a
+// background thread, the calling thread only copies the arguments. Before
+// log_start() and after log_stop(), records are formatted right away.
+void log_start();
+void log_stop();
+// reserves a record, nullptr when the ring is full and the record is dropped
+LogRecord* log_acquire();
+void log_commit(LogRecord* record);
+bool log_running();
+
+namespace log_detail {
+
+template <typename T>
+constexpr bool is_str = std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, const char*>;
+
+template <typename T> using stored_t = std::conditional_t<is_str<T>, const char*, std::decay_t<T>>;
+
+template <typename T> constexpr size_t max_size() {
+    if constexpr (is_str<T>) {
+        return LOG_STR_MAX;
+    } else {
+        return sizeof(T);
+    }
+}
+
+template <typename T> void put(char*& p, const T& v) {
+    if constexpr (is_str<T>) {
+        const char* s = v ? v : "(null)";
+        size_t n      = strnlen(s, LOG_STR_MAX - 1);
+        memcpy(p, s, n);
+        p[n] = 0;
+        p += n + 1;
+    } else {
+        static_assert(std::is_trivially_copyable_v<T>, "log arguments must be scalars or C strings");
+        memcpy(p, &v, sizeof(v));
+        p += sizeof(v);
+    }
+}
+
+template <typename T> T take(const char*& p) {
+    if constexpr (std::is_same_v<T, const char*>) {
+        const char* s = p;
+        p += strlen(s) + 1;
+        return s;
+    } else {
+        T v;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-security"
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+template <typename... Ts> void format(FILE* out, const LogSite* site, [[maybe_unused]] const char* payload) {
+    // braced init evaluates left to right, the order the arguments were put
+    std::tuple<Ts...> args{take<Ts>(payload)...};
+    fprintf(out, "[%s:%d, %s][%s] ", site->file, site->line, site->function, ll_name(site->level));
+    std::apply([&](auto... a) { fprintf(out, site->fmt, a...); }, args);
+    fputc('\n', out);
+}
+#pragma GCC diagnostic pop
+
+template <typename... Ts> void fill(LogRecord* record, const LogSite& site, const Ts&... args) {
+    static_assert((max_size<stored_t<Ts>>() + ... + 0) <= LOG_PAYLOAD, "too many log arguments");
+    record->site             = &site;
+    record->format           = &format<stored_t<Ts>...>;
+    [[maybe_unused]] char* p = record->payload;
+    (put<stored_t<Ts>>(p, args), ...);
+}
+
+template <typename... Ts> void push(const LogSite& site, const Ts&... args) {
+    if (!log_running()) {
+        LogRecord local{};
+        fill(&local, site, args...);
+        local.format(stdout, local.site, local.payload);
+        return;
+    }
+    if (LogRecord* record = log_acquire()) {
+        fill(record, site, args...);
+        log_commit(record);
+    }
+}
+
+} // namespace log_detail
+
+#define LLOG(log_level, fmt, args...)                                                                                 \
+    do {                                                                                                              \
+        if constexpr (log_level <= LANMAI_MIN_LOG_LEVEL) {                                                            \
+            if (log_level <= GLOBAL_LOG_LEVEL) {                                                                      \
+                static const LogSite lanmai_log_site{__FILE__, __LINE__, __FUNCTION__, log_level, fmt};               \
+                log_detail::push(lanmai_log_site, ##args);                                                            \
+            }                                                                                                         \
+            /* never runs, it only has the compiler check fmt against args */                                         \
+            if (false) {                                                                                              \
+                printf(fmt, ##args);                                                                                  \
+            }                                                                                                         \
+        }                                                                                                             \
     } while (false)
@@ -1,59 +1,198 @@
 #pragma once
 
 #include "common.h"
+#include "inline_vec.h"
+#include "keymap.h"
 #include "third_party/json.hpp"
+#include <array>
+#include <bitset>
 #include <cstdio>
 #include <libevdev/libevdev-uinput.h>
 #include <libevdev/libevdev.h>
 #include <linux/input.h>
-#include <list>
-#include <map>
-#include <set>
+#include <memory>
 #include <sys/types.h>
 #include <tuple>
+#include <utility>
+
+// keys LayerMapper can hold down through layers at once
+constexpr size_t MAX_LAYER_HELD = 32;
+// macros waiting for the one playing
+constexpr size_t MAX_QUEUED_MACROS = 8;
+// events one input can expand to through the whole mapper chain
+constexpr size_t MAX_MAPPED_EVENTS = 64;
+using Events = InlineVec<input_event, MAX_MAPPED_EVENTS>;
 
 class SingleMapper {
   public:
+    SingleMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) {}
     input_event map(input_event);
-    bool empty() const { return keys.empty(); };
-    void add_key(uint k1, uint k2) { keys[k1] = k2; }
 
   private:
-    std::map<uint, uint> keys;
+    std::shared_ptr<const Keymap> km;
+};
+
+// Turns keys pressed together within a window into another key. Presses that
+// could still start a chord wait in a buffer, and go on in order as soon as no
+// chord can match any more or the window is over.
+class ChordMapper {
+  public:
+    ChordMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) {}
+    // appends the mapped events to out
+    void map(input_event input, Events& out);
+    // when the buffered keys have to be resolved, in ns of the event clock, 0
+    // if nothing is buffered
+    uint64_t deadline() const { return buffer_deadline; }
+    // resolves the buffered keys, their window is over
+    void expire(Events& out);
+
+  private:
+    void press(const input_event& input, Events& out);
+    // fires the chord of exactly the buffered keys if there is one, else lets
+    // them go unmapped
+    void resolve(Events& out);
+    void fire(uint chord, Events& out);
+
+    std::shared_ptr<const Keymap> km;
+    InlineVec<input_event, Keymap::MAX_CHORD_KEYS> buffer;
+    // chords having all the buffered keys
+    std::bitset<Keymap::MAX_CHORDS> candidates;
+    uint64_t buffer_deadline = 0;
+    // chord + 1 each source key is held for, 0 if none
+    std::array<uint16_t, KEY_CNT> held_for{};
+    // keys of each fired chord still held, its key is released with the first
+    std::array<uint8_t, Keymap::MAX_CHORDS> chord_down{};
 };
 
 class DoubleMapper {
   public:
-    std::list<input_event> map(input_event);
-    void add_key(uint k, uint k1, uint k2) { keys.emplace(k, Info(k1, k2)); }
-    bool empty() const { return keys.empty(); };
+    DoubleMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) {}
+    // appends the mapped events to out
+    void map(input_event, Events& out);
+    // when the pending key resolves as its press key on its own, in ns of the
+    // event clock, 0 if there is no such key
+    uint64_t deadline() const { return pending_deadline; }
+    // resolves the pending key as its press key, its deadline passed
+    void expire(Events& out);
 
   private:
-    struct Info {
-        bool pressed      = false;
-        bool as_press_key = false;
-        uint click_key;
-        uint press_key;
-        Info(uint k1, uint k2) : click_key(k1), press_key(k2) {}
-    };
-    std::map<uint, Info> keys;
-    std::set<uint> pressed_set;
+    void resolve_pending(input_event at, Events& out);
+
+    static constexpr uint NONE = KEY_CNT;
+    std::shared_ptr<const Keymap> km;
+    std::bitset<KEY_CNT> as_press_key;
+    // the double key waiting to be resolved as click or press key, a new press
+    // always resolves the previous one, so there is at most one.
+    uint pending              = NONE;
+    uint64_t pending_deadline = 0;
 };
 
-class MetaMapper {
+// Resolves every press in the highest active layer mapping the key. What each
+// key was pressed as is kept, its repeats and release go to that same key, and
+// the keys pressed through a layer are released when the layer goes off.
+class LayerMapper {
   public:
-    MetaMapper() = default;
-    MetaMapper(uint key, uint click_key, std::map<uint, uint> keys) : key(key), click_key(click_key), keys(keys) {}
-    std::list<input_event> map(input_event input);
-    bool empty() const { return keys.empty(); };
+    LayerMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) { pressed_as.fill(NONE); }
+    // appends the mapped events to out
+    void map(input_event input, Events& out);
 
   private:
-    bool pressed     = false;
-    bool as_meta_key = false;
-    uint key;
-    uint click_key;
-    std::map<uint, uint> keys;
-    std::list<input_event> mapped_inputs;
+    static constexpr uint16_t NONE = 0xffff;
+    // released already, when the layer it was pressed through went off
+    static constexpr uint16_t RELEASED = 0xfffe;
+
+    void press(input_event input, Events& out);
+    void release(input_event input, Events& out);
+    void update(const input_event& input, Events& out);
+    void forget(uint code);
+
+    std::shared_ptr<const Keymap> km;
+    // bit n is set when layer n is on, effective also needs its parents on
+    uint16_t active    = 1;
+    uint16_t effective = 1;
+    // the momentary layer whose click is sent if no other key is pressed
+    // before its key is released
+    int tap = -1;
+    // per source key, the key or LAYER_KEY | layer it was pressed as
+    std::array<uint16_t, KEY_CNT> pressed_as;
+    std::array<uint8_t, KEY_CNT> pressed_in{};
+    // source keys pressed through a layer above the base and not released yet
+    InlineVec<uint16_t, MAX_LAYER_HELD> held;
 };
 
-std::tuple<SingleMapper, DoubleMapper, MetaMapper> get_mappers(const nlohmann::json& cfg);
+// Plays the macro of a key pressed, last in the chain so a layer can map to a
+// macro key. The events are sent over time, at most one every pace ms, so they
+// are due at deadline() and sent by expire(). Macros started while one plays
+// wait for it.
+class MacroMapper {
+  public:
+    MacroMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) {}
+    // appends the mapped events to out
+    void map(input_event input, Events& out);
+    // when the next step is due, in ns of the event clock, 0 if no macro plays
+    uint64_t deadline() const { return playing ? next_at : 0; }
+    // appends the events due at now_ns to out
+    void expire(uint64_t now_ns, Events& out);
+
+  private:
+    void start(uint macro, uint64_t at_ns);
+    void play(uint64_t now_ns, Events& out);
+
+    std::shared_ptr<const Keymap> km;
+    bool playing     = false;
+    uint macro       = 0;
+    uint step        = 0;
+    uint64_t next_at = 0;
+    InlineVec<uint8_t, MAX_QUEUED_MACROS> queued;
+};
+
+// Repeats the key pressed last while it's held, as the kernel does for a
+// keyboard, at the delay and rate the keymap has for it. The repeats of the
+// devices for those keys are dropped, so a key repeats the same whatever it
+// was mapped from. Last in the chain, it sees the keys as they are sent.
+class RepeatMapper {
+  public:
+    RepeatMapper(std::shared_ptr<const Keymap> km) : km(std::move(km)) {}
+    // appends the mapped events to out
+    void map(input_event input, Events& out);
+    // when the next repeat is due, in ns of the event clock, 0 if no key repeats
+    uint64_t deadline() const { return repeating != NONE ? next_at : 0; }
+    // appends the repeat due at now_ns to out
+    void expire(uint64_t now_ns, Events& out);
+
+  private:
+    static constexpr uint NONE = KEY_CNT;
+    std::shared_ptr<const Keymap> km;
+    uint repeating   = NONE;
+    uint64_t next_at = 0;
+};
+
+using Mappers = std::tuple<SingleMapper, ChordMapper, DoubleMapper, LayerMapper, MacroMapper, RepeatMapper>;
+
+Mappers get_mappers(std::shared_ptr<const Keymap> km);
+Mappers get_mappers(const nlohmann::json& cfg);
+
+// The mapper chain the key events of all devices go through.
+class Pipeline {
+  public:
+    explicit Pipeline(const Mappers& mappers)
+        : sm(std::get<0>(mappers)), cm(std::get<1>(mappers)), dm(std::get<2>(mappers)), lm(std::get<3>(mappers)),
+          mm(std::get<4>(mappers)), rm(std::get<5>(mappers)) {}
+    // the result is valid until the next call
+    const Events& map(const input_event& input);
+    // the earliest deadline of the stages, 0 if none
+    uint64_t deadline() const;
+    // no stage waits for a deadline to resolve keys, a key repeating aside
+    bool settled() const { return !cm.deadline() && !dm.deadline() && !mm.deadline(); }
+    // maps what the deadlines passed at now_ns resolved, valid until the next call
+    const Events& expire(uint64_t now_ns);
+
+  private:
+    SingleMapper sm;
+    ChordMapper cm;
+    DoubleMapper dm;
+    LayerMapper lm;
+    MacroMapper mm;
+    RepeatMapper rm;
+    Events cm_out, dm_out, lm_out, mm_out, out;
+};
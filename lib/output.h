@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+#include "inline_vec.h"
+#include "key_state.h"
+#include "uring.h"
+#include <libevdev/libevdev-uinput.h>
+#include <cstdint>
+#include <linux/input.h>
+
+// events of one output frame, a frame larger than this is split
+constexpr size_t MAX_FRAME_EVENTS = 256;
+
+// Collects the events of one input frame and writes them to uinput with a
+// single write(), terminated by one SYN_REPORT. With uring, the write is queued
+// and sent by the next submit of the loop. The keys it pressed are tracked, the
+// redundant events of a KeyState are dropped.
+class Output {
+  public:
+    explicit Output(const libevdev_uinput* uidev, Uring* uring = nullptr)
+        : Output(libevdev_uinput_get_fd(uidev), uring) {}
+    // writes to fd, e.g. /dev/null in lanmai_bench
+    explicit Output(int fd, Uring* uring = nullptr) : fd(fd), uring(uring) {}
+    void push(const input_event& e);
+    void push(unsigned int type, unsigned int code, int value);
+    // writes the pending frame, returns false if it was empty
+    bool flush();
+    bool any_down() const { return keys.any(); }
+    const KeyState& pressed() const { return keys; }
+    // pushes a release of every key down, returns how many
+    uint release_all();
+
+  private:
+    int fd;
+    Uring* uring;
+    // pressed on the uinput device
+    KeyState keys;
+    // one slot is kept for the SYN_REPORT
+    InlineVec<input_event, MAX_FRAME_EVENTS + 1> frame;
+};
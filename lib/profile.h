@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+#include "third_party/json.hpp"
+#include <cstdint>
+
+// Which devices a profile of the config is for. Trivially copyable, it's part
+// of the config cache.
+struct ProfileMatch {
+    static constexpr uint MAX_PROFILES = 16;
+
+    // of the profile, for the logs
+    char name[32];
+    // -1 for any
+    int32_t vendor;
+    int32_t product;
+    // fnmatch patterns, empty for any
+    char device_name[128];
+    char phys[64];
+    // its devices are neither opened nor grabbed
+    bool exclude;
+
+    bool operator==(const ProfileMatch&) const = default;
+};
+
+ProfileMatch compile_profile_match(const std::string& name, const nlohmann::json& v);
+bool matches(const ProfileMatch& profile, const DeviceId& id);
+// its strings are terminated and its ids in range, for one read from the cache
+bool check_profile(const ProfileMatch& profile);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "args.h"
+#include "third_party/json.hpp"
+#include <sched.h>
+#include <string>
+
+// How the event loop thread runs, from the "realtime" object of the config,
+// the command line options override it. Trivially copyable, it's part of the
+// config cache.
+struct RtOptions {
+    int policy       = SCHED_OTHER;
+    int priority     = 50;
+    bool lock_memory = false;
+    // no cpu set for not pinned
+    cpu_set_t cpus{};
+};
+
+// "0-3,6" to {0, 1, 2, 3, 6}, false if it is not a cpu list
+bool parse_cpus(const std::string& s, cpu_set_t& cpus);
+RtOptions rt_config(const nlohmann::json& cfg);
+RtOptions rt_options(RtOptions opts, const Args& args);
+
+// Applies the options to the calling thread, threads started earlier keep
+// their scheduling. Every option that can't be applied is logged with what it
+// needs, the others still are, returns whether all of them were.
+bool apply_realtime(const RtOptions& opts);
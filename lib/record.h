@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <linux/input.h>
+#include <string>
+
+// One event of a record file, in host byte order.
+struct RecordEvent {
+    uint64_t time_ns;
+    int32_t value;
+    uint16_t code;
+    uint8_t type;
+    // index of the device in the recording session
+    uint8_t device;
+
+    input_event to_input() const;
+    static RecordEvent from_input(uint8_t device, const input_event& e);
+};
+static_assert(sizeof(RecordEvent) == 16);
+
+// Writes evdev streams to a record file: an 8-byte magic followed by
+// RecordEvents.
+class Recorder {
+  public:
+    Recorder() = default;
+    ~Recorder() { close(); }
+    Recorder(const Recorder&)            = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return file != nullptr; }
+    void write(uint8_t device, const input_event& e) { write(RecordEvent::from_input(device, e)); }
+    void write(const RecordEvent& e);
+
+  private:
+    FILE* file = nullptr;
+};
+
+class RecordReader {
+  public:
+    RecordReader() = default;
+    ~RecordReader();
+    RecordReader(const RecordReader&)            = delete;
+    RecordReader& operator=(const RecordReader&) = delete;
+
+    // checks the magic
+    bool open(const std::string& path);
+    // returns false at the end of the file
+    bool next(RecordEvent& e);
+
+  private:
+    FILE* file = nullptr;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class EventLoop;
+struct io_uring;
+struct io_uring_sqe;
+
+// io_uring I/O for an EventLoop, built when liburing is found. Reads stay
+// posted on their fd, re-posted after each completion, behind a poll once the
+// fd is drained, and writes are queued, all of what a batch of the loop queued
+// goes to the kernel with one submit(). Completions are reaped through an
+// eventfd in the loop, on its thread.
+class Uring {
+  public:
+    // bytes read or -errno, data is valid during the call
+    using ReadCallback = std::function<void(int res, const char* data)>;
+    struct ReadOp;
+
+    // nullptr when lanmai is built without it or the kernel doesn't allow it
+    static std::unique_ptr<Uring> create(EventLoop& loop);
+    ~Uring();
+    Uring(const Uring&)            = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // reads up to len bytes of fd until cancel()
+    ReadOp* read(int fd, size_t len, ReadCallback cb);
+    // cb isn't called anymore, from the callback too
+    void cancel(ReadOp* op);
+    // data is copied, writes of a batch are done in order
+    void write(int fd, const void* data, size_t len);
+    // sends everything queued since the last call
+    void submit();
+    // submits and waits for the writes, a bounded time, before their fd is
+    // closed. No read callback is called from it.
+    void finish_writes();
+
+  private:
+    struct WriteOp;
+    // the user data and result of a request
+    struct Completion {
+        uint64_t data;
+        int res;
+    };
+
+    Uring(EventLoop& loop, io_uring* ring, int efd);
+    io_uring_sqe* get_sqe();
+    void post(ReadOp* op, bool poll);
+    void reap();
+    void write_done(uint64_t data, int res);
+    // calls the callback of a read and posts it again
+    void read_done(uint64_t data, int res);
+
+    EventLoop& loop;
+    io_uring* ring;
+    int efd;
+    std::vector<std::unique_ptr<ReadOp>> reads;
+    std::vector<std::unique_ptr<WriteOp>> writes;
+    // reads completed during finish_writes(), done by the next reap()
+    std::vector<Completion> deferred;
+    // the last write queued, the next one is linked to it
+    io_uring_sqe* last_write = nullptr;
+    bool queued              = false;
+};
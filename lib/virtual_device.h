@@ -0,0 +1,98 @@
+#pragma once
+
+#include "clone_device.h"
+#include "common.h"
+#include "event_loop.h"
+#include "mapper.h"
+#include "output.h"
+#include <array>
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <optional>
+#include <vector>
+
+// The one uinput device every grabbed device writes to, with the mapper state
+// shared by the devices of a keymap, so a key held on one keyboard applies to
+// the keys of the others. It has every key, and the switches and leds of the
+// grabbed devices, their axes and buttons go to a CloneDevice each. All of it
+// runs on the EventLoop thread.
+class VirtualDevice {
+  public:
+    // a keymap per mappers, see Config::keymaps
+    VirtualDevice(EventLoop& loop, const std::vector<Mappers>& mappers);
+    ~VirtualDevice();
+    VirtualDevice(const VirtualDevice&)            = delete;
+    VirtualDevice& operator=(const VirtualDevice&) = delete;
+
+    // creates the uinput device
+    bool open();
+    // writes the frames to fd instead, e.g. /dev/null in lanmai_bench
+    bool open(int fd);
+    void close();
+    // adds the keys, switches and leds of the evdev device fd it lacks, the
+    // uinput device is created again then with the same keys down, false if
+    // that failed
+    bool add_capabilities(int fd);
+    // the node of the uinput device, nullptr if there's none
+    const char* devnode() const { return uidev ? libevdev_uinput_get_devnode(uidev) : nullptr; }
+    bool has(uint type, uint code) const { return dev && libevdev_has_event_code(dev, type, code); }
+    // maps a key event of a grabbed device using keymap into the current frame,
+    // a key held on several devices of keymap is released with the last one.
+    // What it maps to that this device lacks, e.g. BTN_LEFT, goes to clone.
+    void key(uint keymap, const input_event& input, CloneDevice* clone = nullptr);
+    // adds an event to the current frame unmapped
+    void push(const input_event& e);
+    // writes the current frame, returns false if it was empty
+    bool flush();
+    // the earliest deadline of the mappers, 0 if none
+    uint64_t deadline() const;
+    // sends what the deadlines passed at now_ns resolved, the deadline timer
+    // calls it with the current time
+    void expire(uint64_t now_ns);
+    // switches each keymap to its mappers once no key is held on its devices
+    // and no macro plays, mappers has as many keymaps as before
+    void reload(const std::vector<Mappers>& mappers);
+    // switches right away, once the devices are closed, after the pending
+    // deadlines are resolved
+    void reset(const std::vector<Mappers>& mappers);
+    // releases the keys still down on the uinput device when no device holds
+    // a key and no mapper waits for a deadline, nothing should be down then
+    void release_stray();
+
+  private:
+    // the mappers of a keymap and the keys of its devices
+    struct Slot {
+        explicit Slot(const Mappers& mappers) : pipeline(mappers) {}
+        // no key held and nothing waiting for a deadline, e.g. a macro playing,
+        // a key lanmai still repeats is released by release_stray()
+        bool quiescent() const { return held == 0 && pipeline.settled(); }
+
+        Pipeline pipeline;
+        // waits for a quiescent point to replace pipeline
+        std::optional<Pipeline> next_pipeline;
+        // devices holding each key, as the pipeline saw them
+        std::array<uint8_t, KEY_CNT> down{};
+        uint held = 0;
+    };
+
+    // dev with the keys of a keyboard
+    bool init();
+    // the uinput device of dev
+    bool create();
+    void destroy();
+    void swap_pipelines();
+    // follows the earliest deadline of the mappers
+    void arm_deadline_timer();
+
+    libevdev* dev          = nullptr;
+    int uifd               = -1;
+    libevdev_uinput* uidev = nullptr;
+    std::optional<Output> output;
+    Uring* uring;
+
+    std::vector<Slot> slots;
+
+    Timer deadline_timer;
+    uint64_t armed_deadline = 0;
+};
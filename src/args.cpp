@@ -21,8 +21,32 @@ Args::Args(int argc, char* argv[]) {
         .implicit_value(true);
     // clang-format off
     parser.add_argument("-d", "--device")
-        .help("specify which one you want to grab")
+        .help("grab only this device, even if it isn't detected as a keyboard")
         .default_value(std::string());
+    parser.add_argument("--latency-file")
+        .help("file the latency histograms are written to as json on SIGUSR1, default: stdout")
+        .default_value(std::string());
+    parser.add_argument("--record")
+        .help("record the raw events of grabbed devices to this file, see lanmai-replay")
+        .default_value(std::string());
+    parser.add_argument("--rt-policy")
+        .help("scheduling policy of the event loop, fifo/rr/other, default: other")
+        .default_value(std::string());
+    parser.add_argument("--rt-priority")
+        .help("priority for fifo/rr, 1-99, default: 50")
+        .default_value(-1)
+        .scan<'i', int>();
+    parser.add_argument("--mlock")
+        .help("lock lanmai's memory so it's never paged out")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("--cpus")
+        .help("pin the event loop to these cpus, e.g. 2,3 or 0-3")
+        .default_value(std::string());
+    parser.add_argument("--io-uring")
+        .help("read devices and write uinput through io_uring, if lanmai is built with it")
+        .default_value(false)
+        .implicit_value(true);
     // clang-format off
     parser.add_argument("-v", "--version")
         .help("lanmai version")
@@ -58,6 +82,13 @@ Args::Args(int argc, char* argv[]) {
 
     config_path     = parser.get<std::string>("-c");
     device         = parser.get<std::string>("-d");
+    latency_file   = parser.get<std::string>("--latency-file");
+    record_file    = parser.get<std::string>("--record");
+    rt_policy      = parser.get<std::string>("--rt-policy");
+    rt_priority    = parser.get<int>("--rt-priority");
+    lock_memory    = parser.get<bool>("--mlock");
+    cpus           = parser.get<std::string>("--cpus");
+    io_uring       = parser.get<bool>("--io-uring");
     std::string ll = parser.get<std::string>("-l");
     if (ll == "DEBUG") {
         log_level = LL_DEBUG;
@@ -0,0 +1,67 @@
+#include "clone_device.h"
+#include "log.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static bool has_bit(const uint8_t* bits, uint n) { return bits[n / 8] & (1 << (n % 8)); }
+
+bool CloneDevice::needed(int fd) {
+    uint8_t types[(EV_CNT + 7) / 8]  = {};
+    uint8_t keys[(KEY_CNT + 7) / 8] = {};
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0) {
+        return false;
+    }
+    if (has_bit(types, EV_REL) || has_bit(types, EV_ABS)) {
+        return true;
+    }
+    if (!has_bit(types, EV_KEY) || ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0) {
+        return false;
+    }
+    for (uint code = BTN_MISC; code < KEY_OK; code++) {
+        if (has_bit(keys, code)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CloneDevice::open(int fd) {
+    if (libevdev_new_from_fd(fd, &dev) < 0) {
+        LLOG(LL_ERROR, "create dev failed");
+        return false;
+    }
+    // the repeats come from the device, force feedback would need its requests
+    // handled
+    libevdev_disable_event_type(dev, EV_REP);
+    libevdev_disable_event_type(dev, EV_FF);
+    uifd = ::open("/dev/uinput", O_RDWR | O_CLOEXEC);
+    if (uifd < 0) {
+        LLOG(LL_ERROR, "open uinput file failed");
+        return false;
+    }
+    if (libevdev_uinput_create_from_device(dev, uifd, &uidev) != 0) {
+        LLOG(LL_ERROR, "create uinput dev failed");
+        return false;
+    }
+    output.emplace(uidev, uring);
+    LLOG(LL_INFO, "clone of %s created: %s", libevdev_get_name(dev), libevdev_uinput_get_devnode(uidev));
+    return true;
+}
+
+CloneDevice::~CloneDevice() {
+    if (output && output->release_all()) {
+        output->flush();
+    }
+    if (output && uring) {
+        uring->finish_writes();
+    }
+    output.reset();
+    if (uidev) {
+        libevdev_uinput_destroy(uidev);
+    }
+    if (uifd >= 0) {
+        ::close(uifd);
+    }
+    libevdev_free(dev);
+}
@@ -1,4 +1,5 @@
 #include "../lib/common.h"
+#include "../lib/keys.h"
 #include "../lib/log.h"
 #include <cstring>
 #include <fcntl.h>
@@ -6,10 +7,55 @@
 #include <libevdev/libevdev-uinput.h>
 #include <libevdev/libevdev.h>
 #include <libudev.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-std::vector<std::string> get_devices(const char* dt) {
-    std::vector<std::string> devnodes;
+static uint16_t hex_attr(udev_device* dev, const char* attr) {
+    const char* v = udev_device_get_sysattr_value(dev, attr);
+    return v ? strtoul(v, nullptr, 16) : 0;
+}
+
+// the attributes are on the inputN parent of the eventN node
+DeviceId device_id(udev_device* dev) {
+    DeviceId id;
+    if (const char* devnode = udev_device_get_devnode(dev)) {
+        id.devnode = devnode;
+    }
+    udev_device* input = udev_device_get_parent_with_subsystem_devtype(dev, "input", nullptr);
+    if (!input) {
+        return id;
+    }
+    if (const char* name = udev_device_get_sysattr_value(input, "name")) {
+        id.name = name;
+    }
+    if (const char* phys = udev_device_get_sysattr_value(input, "phys")) {
+        id.phys = phys;
+    }
+    id.vendor  = hex_attr(input, "id/vendor");
+    id.product = hex_attr(input, "id/product");
+    return id;
+}
+
+DeviceId device_id_of(const std::string& devnode) {
+    DeviceId id;
+    id.devnode = devnode;
+    struct stat sb;
+    struct udev* udev = udev_new();
+    if (!udev || stat(devnode.c_str(), &sb) < 0) {
+        udev_unref(udev);
+        return id;
+    }
+    if (udev_device* dev = udev_device_new_from_devnum(udev, 'c', sb.st_rdev)) {
+        id         = device_id(dev);
+        id.devnode = devnode;
+        udev_device_unref(dev);
+    }
+    udev_unref(udev);
+    return id;
+}
+
+std::vector<DeviceId> get_devices(const char* dt) {
+    std::vector<DeviceId> ids;
     struct udev* udev;
     struct udev_enumerate* enumerate;
     struct udev_list_entry *devices, *dev_list_entry;
@@ -34,37 +80,28 @@ std::vector<std::string> get_devices(const char* dt) {
         const char* virtual_dev_prefix = "/sys/devices/virtual/";
         LLOG(LL_INFO, "path: %s, devnode: %s", path, devnode);
         if (devnode && strncmp(virtual_dev_prefix, path, strlen(virtual_dev_prefix))) {
-            devnodes.push_back(std::string(devnode));
+            ids.push_back(device_id(dev));
         }
         udev_device_unref(dev);
     }
     udev_enumerate_unref(enumerate);
     udev_unref(udev);
-    return devnodes;
+    return ids;
 }
 
+// what a profile can match them on
 void print_all_kbd_devices() {
-    for (auto&& path : get_kbd_devices()) {
-        int fd = open(path.c_str(), O_RDONLY);
-        if (fd < 0) {
-            LLOG(LL_ERROR, "open file:%s failed.", path.c_str());
-            return;
-        }
-        Defer fd_defer{[&]() { close(fd); }};
-
-        libevdev* dev = nullptr;
-        Defer dev_defer{[&]() { libevdev_free(dev); }};
-        if (libevdev_new_from_fd(fd, &dev) < 0) {
-            LLOG(LL_ERROR, "create dev failed");
-            return;
-        }
-        printf("dev: \e[1;34m%s\e[m, name: %s\n", path.c_str(), libevdev_get_name(dev));
+    for (auto&& id : get_kbd_devices()) {
+        printf("dev: \e[1;34m%s\e[m, name: %s, vendor: %04x, product: %04x, phys: %s\n", id.devnode.c_str(),
+               id.name.c_str(), id.vendor, id.product, id.phys.c_str());
     }
 }
 
 void print_all_keys() {
     printf("keys:\n");
-    for (auto&& [code, key] : TABLE_REV) {
-        printf("\t%s\n", key.c_str());
+    for (uint code = 0; code < KEY_CNT; code++) {
+        if (auto name = key_name(code)) {
+            printf("\t%s\n", name);
+        }
     }
 }
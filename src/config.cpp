@@ -2,7 +2,8 @@
 #include "common.h"
 #include "err.h"
 #include "log.h"
-#include <asm/errno.h>
+#include <cerrno>
+#include <cstring>
 #include <exception>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -10,20 +11,38 @@
 #include <unistd.h>
 
 std::string read_file(const std::string& path) {
-    int fd = open(path.c_str(), O_RDONLY);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
-        LLOG(LL_ERROR, "open file:%s failed, %s", path.c_str(), strerror(fd));
+        LLOG(LL_ERROR, "open file:%s failed, %s", path.c_str(), strerror(errno));
         throw OPEN_FILE_ERROR;
     }
     Defer defer([fd]() { close(fd); });
 
     struct stat sb;
-    fstat(fd, &sb);
+    if (fstat(fd, &sb) < 0) {
+        LLOG(LL_ERROR, "stat file:%s failed, %s", path.c_str(), strerror(errno));
+        throw OPEN_FILE_ERROR;
+    }
 
     std::string s;
     s.resize(sb.st_size);
-
-    read(fd, s.data(), sb.st_size);
+    // read() may return less than asked, the file may also shrink meanwhile
+    size_t got = 0;
+    while (got < s.size()) {
+        ssize_t n = read(fd, s.data() + got, s.size() - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            LLOG(LL_ERROR, "read file:%s failed, %s", path.c_str(), strerror(errno));
+            throw OPEN_FILE_ERROR;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    s.resize(got);
     return s;
 }
 
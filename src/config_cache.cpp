@@ -0,0 +1,207 @@
+#include "config_cache.h"
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable_v<CompiledConfig> && std::is_trivially_copyable_v<Keymap>,
+              "the cache holds them as they are in memory");
+
+static constexpr char CACHE_MAGIC[8] = {'l', 'a', 'n', 'm', 'a', 'i', 'k', 'm'};
+// bump it when CompiledConfig changes in a way its size doesn't tell
+static constexpr uint32_t CACHE_FORMAT = 2;
+
+// no padding, so headers compare with memcmp
+struct CacheHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t size;
+    uint32_t keymap_size;
+    char reserved[4];
+    // the key names may resolve to other codes in another version
+    char version[16];
+    // the config the cache was compiled from
+    int64_t config_mtime_ns;
+    uint64_t config_size;
+    uint64_t config_hash;
+};
+static_assert(sizeof(CacheHeader) == 64 && sizeof(CacheHeader) % alignof(CompiledConfig) == 0);
+static_assert((sizeof(CacheHeader) + sizeof(CompiledConfig)) % alignof(Keymap) == 0);
+
+// the header, the compiled config, then the default keymap and one per profile
+static constexpr size_t cache_size(uint profile_cnt) {
+    return sizeof(CacheHeader) + sizeof(CompiledConfig) + (profile_cnt + 1) * sizeof(Keymap);
+}
+
+// FNV-1a
+static uint64_t hash_of(const std::string& s) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (unsigned char c : s) {
+        h = (h ^ c) * 0x100000001b3;
+    }
+    return h;
+}
+
+std::string cache_path(const std::string& config_path) { return config_path + ".cache"; }
+
+int Config::keymap_of(const DeviceId& id) const {
+    for (uint i = 0; i < compiled->profile_cnt; i++) {
+        auto& profile = compiled->profiles[i];
+        if (matches(profile, id)) {
+            LLOG(LL_INFO, "%s matches profile %s, excluded: %d", id.devnode.c_str(), profile.name, profile.exclude);
+            return profile.exclude ? -1 : int(i + 1);
+        }
+    }
+    return 0;
+}
+
+bool Config::same_profiles(const Config& other) const {
+    auto& a = *compiled;
+    auto& b = *other.compiled;
+    return a.profile_cnt == b.profile_cnt &&
+           std::equal(a.profiles.begin(), a.profiles.begin() + a.profile_cnt, b.profiles.begin());
+}
+
+std::vector<Mappers> Config::mappers() const {
+    std::vector<Mappers> res;
+    for (auto& km : keymaps) {
+        res.push_back(get_mappers(km));
+    }
+    return res;
+}
+
+static std::optional<Config> map_cache(const std::string& path, const CacheHeader& expected) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    Defer defer([fd]() { close(fd); });
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || size_t(sb.st_size) < cache_size(0)) {
+        return std::nullopt;
+    }
+    size_t len = sb.st_size;
+    void* base = mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (base == MAP_FAILED) {
+        LLOG(LL_INFO, "mmap %s failed, %s", path.c_str(), strerror(errno));
+        return std::nullopt;
+    }
+    // everything taken from the mapping keeps it
+    std::shared_ptr<const char> mapping(static_cast<const char*>(base), [len](const char* p) {
+        munmap(const_cast<char*>(p), len);
+    });
+    if (memcmp(base, &expected, sizeof(expected)) != 0) {
+        return std::nullopt;
+    }
+    auto cc = reinterpret_cast<const CompiledConfig*>(mapping.get() + sizeof(CacheHeader));
+    if (cc->profile_cnt > ProfileMatch::MAX_PROFILES || len != cache_size(cc->profile_cnt)) {
+        return std::nullopt;
+    }
+    Config config;
+    config.compiled = std::shared_ptr<const CompiledConfig>(mapping, cc);
+    auto keymaps    = reinterpret_cast<const Keymap*>(mapping.get() + sizeof(CacheHeader) + sizeof(CompiledConfig));
+    for (uint i = 0; i <= cc->profile_cnt; i++) {
+        config.keymaps.push_back(std::shared_ptr<const Keymap>(mapping, keymaps + i));
+    }
+    // the mappers index their tables with what they hold, checked once here
+    // rather than on every event
+    bool valid = std::all_of(cc->profiles.begin(), cc->profiles.begin() + cc->profile_cnt, check_profile) &&
+                 std::all_of(keymaps, keymaps + cc->profile_cnt + 1, check_keymap);
+    if (!valid) {
+        LLOG(LL_ERROR, "%s is corrupted, compile the config again", path.c_str());
+        return std::nullopt;
+    }
+    return config;
+}
+
+static bool write_all(int fd, const void* data, size_t len) {
+    auto p = static_cast<const char*>(data);
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// written aside and renamed, a reader never sees a partial cache
+static void write_cache(const std::string& path, const CacheHeader& header, const Config& config) {
+    std::string tmp = path + ".tmp";
+    int fd          = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LLOG(LL_INFO, "can't write %s, %s, the config is compiled at every start", path.c_str(), strerror(errno));
+        return;
+    }
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, config.compiled.get(), sizeof(CompiledConfig));
+    for (auto& km : config.keymaps) {
+        ok = ok && write_all(fd, km.get(), sizeof(Keymap));
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+        LLOG(LL_INFO, "write %s failed, %s", path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+    }
+}
+
+Config load_config(const std::string& config_path) {
+    struct stat sb;
+    if (stat(config_path.c_str(), &sb) < 0) {
+        LLOG(LL_ERROR, "stat file:%s failed, %s", config_path.c_str(), strerror(errno));
+        throw OPEN_FILE_ERROR;
+    }
+    // stat first, a change while reading makes the next start compile again
+    std::string text = read_file(config_path);
+
+    CacheHeader header{};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.format      = CACHE_FORMAT;
+    header.size        = sizeof(CompiledConfig);
+    header.keymap_size = sizeof(Keymap);
+    strncpy(header.version, LANMAI_VERSION, sizeof(header.version) - 1);
+    header.config_mtime_ns = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    header.config_size     = text.size();
+    header.config_hash     = hash_of(text);
+
+    std::string path = cache_path(config_path);
+    if (auto config = map_cache(path, header)) {
+        LLOG(LL_INFO, "config loaded from %s", path.c_str());
+        return std::move(*config);
+    }
+
+    json cfg     = json::parse(text);
+    auto cc      = std::make_shared<CompiledConfig>();
+    cc->realtime = rt_config(cfg);
+    Config config;
+    config.keymaps.push_back(std::make_shared<const Keymap>(compile_keymap(cfg)));
+    // an array, the first profile matching a device is its profile
+    if (auto it = cfg.find("profiles"); it != cfg.end()) {
+        if (it->size() > ProfileMatch::MAX_PROFILES) {
+            LLOG(LL_ERROR, "too many profiles: %zu, at most %u", it->size(), ProfileMatch::MAX_PROFILES);
+            throw PROFILE_ERROR;
+        }
+        for (auto& v : *it) {
+            auto name                        = v.value("name", "profile " + std::to_string(cc->profile_cnt));
+            cc->profiles[cc->profile_cnt++] = compile_profile_match(name, v);
+            config.keymaps.push_back(std::make_shared<const Keymap>(compile_keymap(v)));
+        }
+    }
+    config.compiled = cc;
+    write_cache(path, header, config);
+    LLOG(LL_INFO, "config compiled, cached to %s", path.c_str());
+    return config;
+}
@@ -0,0 +1,438 @@
+#include "device.h"
+#include "log.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// longest wait for held keys to be released before grabbing anyway
+static constexpr auto GRAB_TIMEOUT = std::chrono::seconds(3);
+// events read by one read(), a few frames of a fast typist
+static constexpr size_t READ_BATCH = 64;
+
+Device::Device(EventLoop& loop, std::string path, VirtualDevice& vdev, uint keymap, Recorder* recorder, uint8_t id)
+    : loop(loop), dev_path(std::move(path)), vdev(vdev), keymap(keymap), grab_timer(loop, [this]() { try_grab(true); }),
+      recorder(recorder), id(id) {}
+
+Device::~Device() { close(); }
+
+bool Device::open() {
+    // written to only to release the keys held at a forced grab
+    fd = ::open(dev_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        LLOG(LL_ERROR, "open file:%s failed.", dev_path.c_str());
+        return false;
+    }
+    int version;
+    if (ioctl(fd, EVIOCGVERSION, &version) < 0) {
+        LLOG(LL_ERROR, "%s is not an evdev device", dev_path.c_str());
+        close();
+        return false;
+    }
+    // timestamps comparable with now_ns()
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+    // its switches or leds go on through the virtual device, a touchpad or
+    // pointing stick through a copy of the device
+    if (!vdev.add_capabilities(fd)) {
+        LLOG(LL_ERROR, "%s: the virtual device can't take its events", dev_path.c_str());
+        close();
+        return false;
+    }
+    if (CloneDevice::needed(fd)) {
+        clone = std::make_unique<CloneDevice>(loop.uring());
+        if (!clone->open(fd)) {
+            LLOG(LL_ERROR, "%s: can't create its copy", dev_path.c_str());
+            close();
+            return false;
+        }
+    }
+    // until the grab, reading only tells when keys are released
+    if (auto uring = loop.uring()) {
+        read_op = uring->read(fd, sizeof(input_event) * READ_BATCH,
+                              [this](int res, const char* data) { handle_read(res, data); });
+    } else if (!loop.add(fd, [this](uint32_t events) { handle_input(events); })) {
+        close();
+        return false;
+    }
+    try_grab(false);
+    if (!closed() && !grabbed) {
+        grab_timer.arm(GRAB_TIMEOUT);
+    }
+    return !closed();
+}
+
+std::bitset<KEY_CNT> Device::keys_down() const {
+    uint8_t bits[(KEY_CNT + 7) / 8] = {};
+    std::bitset<KEY_CNT> down;
+    if (ioctl(fd, EVIOCGKEY(sizeof(bits)), bits) < 0) {
+        return down;
+    }
+    for (uint code = 0; code < KEY_CNT; code++) {
+        down[code] = bits[code / 8] & (1 << (code % 8));
+    }
+    return down;
+}
+
+// grabbing while a key is held would leave it pressed for everyone else, so
+// wait for all keys to be released. When force is set, after GRAB_TIMEOUT, the
+// keys still held are released for everyone else before.
+void Device::try_grab(bool force) {
+    // everyone saw the events queued so far, they must not be mapped again
+    read_events(false);
+    if (closed()) {
+        return;
+    }
+    auto down = keys_down();
+    if (down.any() && !force) {
+        return;
+    }
+    grab_timer.disarm();
+    if (down.any()) {
+        // the kernel drops the real releases then, as the keys are up already.
+        // The copy lanmai reads is dropped here, or by handle_key() as the
+        // releases of keys that aren't down when a uring read has it.
+        release_held(down);
+        read_events(false);
+        if (closed()) {
+            return;
+        }
+        down = keys_down();
+    }
+
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        LLOG(LL_ERROR, "grab dev failed");
+        close();
+        return;
+    }
+    grabbed  = true;
+    dropping = false;
+
+    // the presses of keys still held, that couldn't be released, went to
+    // everyone else, drop the rest of their events so the mappers never see a
+    // release without its press.
+    held_at_grab = down;
+    if (down.any()) {
+        LLOG(LL_INFO, "%s grabbed with %zu keys held", dev_path.c_str(), down.count());
+    } else {
+        LLOG(LL_INFO, "%s grabbed", dev_path.c_str());
+    }
+}
+
+// written to the device, its readers get them as if they came from it
+void Device::release_held(const std::bitset<KEY_CNT>& keys) {
+    std::vector<input_event> events;
+    for (uint code = 0; code < KEY_CNT; code++) {
+        if (keys[code]) {
+            input_event e{};
+            e.type  = EV_KEY;
+            e.code  = code;
+            e.value = 0;
+            events.push_back(e);
+        }
+    }
+    input_event syn{};
+    syn.type = EV_SYN;
+    syn.code = SYN_REPORT;
+    events.push_back(syn);
+    size_t len = events.size() * sizeof(input_event);
+    if (write(fd, events.data(), len) != ssize_t(len)) {
+        LLOG(LL_ERROR, "%s: release the held keys failed, %s", dev_path.c_str(), strerror(errno));
+        return;
+    }
+    LLOG(LL_INFO, "%s: released %zu keys held past the grab timeout", dev_path.c_str(), keys.count());
+}
+
+void Device::close() {
+    if (fd < 0) {
+        return;
+    }
+    grab_timer.disarm();
+    if (read_op) {
+        loop.uring()->cancel(read_op);
+        read_op = nullptr;
+    } else {
+        loop.remove(fd);
+    }
+    release_keys();
+    clone.reset();
+    if (grabbed) {
+        ioctl(fd, EVIOCGRAB, 0);
+        grabbed = false;
+    }
+    ::close(fd);
+    fd = -1;
+    LLOG(LL_INFO, "%s closed", dev_path.c_str());
+    if (closed_cb) {
+        closed_cb();
+    }
+}
+
+void Device::handle_input(uint32_t events) {
+    if (grabbed) {
+        read_events(true);
+    } else {
+        try_grab(false);
+    }
+    if (!closed() && (events & (EPOLLHUP | EPOLLERR))) {
+        close();
+    }
+}
+
+void Device::handle_read(int res, const char* data) {
+    if (res == -EINTR) {
+        return;
+    }
+    if (res <= 0 || res % sizeof(input_event)) {
+        close();
+        return;
+    }
+    if (!grabbed) {
+        try_grab(false);
+        return;
+    }
+    handle_events(reinterpret_cast<const input_event*>(data), res / sizeof(input_event));
+}
+
+void Device::handle_events(const input_event* events, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        handle_event(events[i]);
+    }
+}
+
+// a read returns whole events, as many as are queued and fit
+void Device::read_events(bool map) {
+    input_event events[READ_BATCH];
+    while (true) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0 || n % sizeof(input_event)) {
+            close();
+            return;
+        }
+        size_t cnt = n / sizeof(input_event);
+        if (map) {
+            handle_events(events, cnt);
+        }
+        // drained, no need for a read that only says so
+        if (cnt < READ_BATCH) {
+            break;
+        }
+    }
+}
+
+void Device::handle_event(const input_event& input) {
+    if (recorder) {
+        recorder->write(id, input);
+    }
+    // the kernel queue overflowed, the events up to the next report are
+    // incomplete, drop them and resync the keys then.
+    if (input.type == EV_SYN && input.code == SYN_DROPPED) {
+        dropping = true;
+        return;
+    }
+    if (dropping) {
+        if (input.type == EV_SYN && input.code == SYN_REPORT) {
+            dropping = false;
+            resync();
+        }
+        return;
+    }
+    if (frame_start) {
+        stats.read.record(ns_of(input.time), now_ns());
+        frame_start = false;
+    }
+
+    // the source frame ends here, write everything it produced at once
+    if (input.type == EV_SYN && input.code == SYN_REPORT) {
+        uint64_t begin = now_ns();
+        if (clone) {
+            clone->flush();
+        }
+        if (vdev.flush()) {
+            uint64_t end = now_ns();
+            stats.write.record(begin, end);
+            stats.total.record(ns_of(input.time), end);
+        }
+        frame_start = true;
+        return;
+    }
+    if (input.type != EV_KEY) {
+        if (clone) {
+            clone->push(input);
+        } else {
+            vdev.push(input);
+        }
+        return;
+    }
+    uint64_t begin = now_ns();
+    handle_key(input);
+    stats.map.record(begin, now_ns());
+}
+
+// the keys the mappers saw go where the device has them now, releases first.
+// Recorded too, a replay can't ask the device.
+void Device::resync() {
+    auto now_down = keys_down();
+    uint64_t now  = now_ns();
+    input_event e{};
+    e.time.tv_sec  = now / 1000000000;
+    e.time.tv_usec = now % 1000000000 / 1000;
+    e.type         = EV_KEY;
+    uint changed   = 0;
+    for (int value : {0, 1}) {
+        for (uint code = 0; code < KEY_CNT; code++) {
+            if (held_at_grab[code]) {
+                held_at_grab[code] = now_down[code];
+            } else if (down[code] != now_down[code] && now_down[code] == bool(value)) {
+                e.code  = code;
+                e.value = value;
+                if (recorder) {
+                    recorder->write(id, e);
+                }
+                handle_key(e);
+                changed++;
+            }
+        }
+    }
+    // recorded as a frame of its own, after the dropped one
+    if (recorder) {
+        input_event syn{};
+        syn.time = e.time;
+        syn.type = EV_SYN;
+        syn.code = SYN_REPORT;
+        recorder->write(id, syn);
+    }
+    if (clone) {
+        clone->flush();
+    }
+    vdev.flush();
+    frame_start = true;
+    LLOG(LL_INFO, "%s dropped events, %u keys resynced", dev_path.c_str(), changed);
+}
+
+void Device::handle_key(const input_event& input) {
+    LLOG(LL_DEBUG, "accept key: type:%d, code:%d, value:%d", input.type, input.code, input.value);
+    if (input.code < KEY_CNT && held_at_grab[input.code]) {
+        if (input.value == 0) {
+            held_at_grab[input.code] = false;
+        }
+        return;
+    }
+    if (input.code < KEY_CNT && input.value != 2) {
+        // the events read along with a resync may tell what it did already
+        if (down[input.code] == bool(input.value)) {
+            return;
+        }
+        down[input.code] = input.value;
+    }
+    vdev.key(keymap, input, clone.get());
+}
+
+// the shared mappers would keep the keys of a device gone mid-press held for
+// every other device, release them as if they were let go. What then stays
+// down on the virtual device with no key held anywhere is released too.
+void Device::release_keys() {
+    if (down.none()) {
+        vdev.release_stray();
+        return;
+    }
+    for (uint code = 0; code < KEY_CNT; code++) {
+        if (down[code]) {
+            input_event e{};
+            e.type  = EV_KEY;
+            e.code  = code;
+            e.value = 0;
+            vdev.key(keymap, e, clone.get());
+        }
+    }
+    down.reset();
+    if (clone) {
+        clone->flush();
+    }
+    vdev.flush();
+    vdev.release_stray();
+}
+
+DeviceTable::DeviceTable(EventLoop& loop, const Config& config, Recorder* recorder)
+    : loop(loop), config(config), vdev(loop, config.mappers()), recorder(recorder) {
+    reap_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reap_fd < 0) {
+        LLOG(LL_ERROR, "Can't create eventfd, %s", strerror(errno));
+        exit(1);
+    }
+    loop.add(reap_fd, [this](uint32_t) { reap(); });
+}
+
+DeviceTable::~DeviceTable() {
+    devices.clear();
+    vdev.close();
+    loop.remove(reap_fd);
+    ::close(reap_fd);
+}
+
+void DeviceTable::reap() {
+    uint64_t n;
+    read(reap_fd, &n, sizeof(n));
+    std::erase_if(devices, [](auto& device) { return device->closed(); });
+}
+
+void DeviceTable::add(const DeviceId& id) {
+    std::erase_if(devices, [](auto& device) { return device->closed(); });
+
+    if (std::any_of(devices.begin(), devices.end(), [&](auto& device) { return device->path() == id.devnode; })) {
+        return;
+    }
+    int keymap = config.keymap_of(id);
+    if (keymap < 0) {
+        return;
+    }
+    auto device = std::make_unique<Device>(loop, id.devnode, vdev, keymap, recorder, next_id);
+    // from its own handler, it's freed once that returned
+    device->on_close([this]() {
+        uint64_t one = 1;
+        write(reap_fd, &one, sizeof(one));
+    });
+    if (device->open()) {
+        LLOG(LL_INFO, "%s added, id: %d", id.devnode.c_str(), next_id);
+        next_id++;
+        devices.push_back(std::move(device));
+    }
+}
+
+void DeviceTable::remove(const std::string& path) {
+    std::erase_if(devices, [&](auto& device) { return device->closed() || device->path() == path; });
+}
+
+bool DeviceTable::reload(const Config& next) {
+    bool same = next.same_profiles(config);
+    config    = next;
+    if (same) {
+        vdev.reload(config.mappers());
+        return true;
+    }
+    // a device may get another keymap, or be excluded now
+    LLOG(LL_INFO, "the profiles changed, grab the devices again");
+    devices.clear();
+    vdev.reset(config.mappers());
+    return false;
+}
+
+nlohmann::json DeviceTable::latency() const {
+    auto res = nlohmann::json::array();
+    for (auto& device : devices) {
+        auto stats      = device->latency().to_json();
+        stats["device"] = device->path();
+        res.push_back(stats);
+    }
+    return res;
+}
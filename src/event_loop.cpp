@@ -0,0 +1,124 @@
+#include "event_loop.h"
+#include "log.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        LLOG(LL_ERROR, "Can't create epoll, %s", strerror(errno));
+        exit(1);
+    }
+}
+
+EventLoop::~EventLoop() {
+    io.reset();
+    close(epfd);
+}
+
+bool EventLoop::use_io_uring() {
+    io = Uring::create(*this);
+    return io != nullptr;
+}
+
+bool EventLoop::add(int fd, Callback cb, uint32_t events) {
+    auto handler = std::make_unique<Handler>(fd, std::move(cb));
+    epoll_event ev{};
+    ev.events   = events;
+    ev.data.ptr = handler.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LLOG(LL_ERROR, "epoll add fd:%d failed, %s", fd, strerror(errno));
+        return false;
+    }
+    handlers[fd] = std::move(handler);
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    auto it = handlers.find(fd);
+    if (it == handlers.end()) {
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    // events of this batch may still point to it
+    it->second->fd = -1;
+    removed.push_back(std::move(it->second));
+    handlers.erase(it);
+}
+
+void EventLoop::run() {
+    constexpr int MAX_EVENTS = 32;
+    epoll_event events[MAX_EVENTS];
+    running = true;
+    while (running) {
+        // what the last batch queued, one syscall for all of it
+        if (io) {
+            io->submit();
+        }
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LLOG(LL_ERROR, "epoll wait failed, %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n && running; i++) {
+            auto handler = static_cast<Handler*>(events[i].data.ptr);
+            if (handler->fd >= 0) {
+                handler->cb(events[i].events);
+            }
+        }
+        removed.clear();
+    }
+}
+
+Timer::Timer(EventLoop& loop, std::function<void()> cb) : loop(loop), cb(std::move(cb)) {
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        LLOG(LL_ERROR, "Can't create timerfd, %s", strerror(errno));
+        exit(1);
+    }
+    loop.add(fd, [this](uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return;
+        }
+        is_armed = false;
+        this->cb();
+    });
+}
+
+Timer::~Timer() {
+    loop.remove(fd);
+    close(fd);
+}
+
+void Timer::arm(std::chrono::nanoseconds after) {
+    // a zero it_value disarms the timer
+    auto ns = std::max(after.count(), decltype(after.count())(1));
+    itimerspec its{};
+    its.it_value.tv_sec  = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(fd, 0, &its, nullptr);
+    is_armed = true;
+}
+
+void Timer::arm_at(uint64_t at_ns) {
+    // a zero it_value disarms the timer
+    at_ns = std::max(at_ns, uint64_t(1));
+    itimerspec its{};
+    its.it_value.tv_sec  = at_ns / 1000000000;
+    its.it_value.tv_nsec = at_ns % 1000000000;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    is_armed = true;
+}
+
+void Timer::disarm() {
+    itimerspec its{};
+    timerfd_settime(fd, 0, &its, nullptr);
+    is_armed = false;
+}
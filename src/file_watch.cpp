@@ -1,61 +1,93 @@
-#include "common.h"
+#include "file_watch.h"
+#include "config_cache.h"
+#include "err.h"
 #include "log.h"
-#include <fcntl.h>
-#include <libevdev/libevdev.h>
-#include <linux/limits.h>
-#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <unistd.h>
 
-bool is_phys_not_null(const char* path) {
-    int fd = open(path, O_RDWR | IN_CLOEXEC);
-    if (fd == -1) {
-        return false;
+ConfigWatcher::ConfigWatcher(std::string config_path) : path(std::move(config_path)) {
+    inotfd  = inotify_init1(IN_CLOEXEC);
+    stopfd  = eventfd(0, EFD_CLOEXEC);
+    readyfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotfd < 0 || stopfd < 0 || readyfd < 0) {
+        LLOG(LL_ERROR, "Can't create inotify.");
+        exit(1);
     }
-
-    Defer fd_defer{[&]() { close(fd); }};
-
-    struct libevdev* dev = nullptr;
-    Defer dev_defer{[&]() { libevdev_free(dev); }};
-    if (libevdev_new_from_fd(fd, &dev) == 0) {
-        const char* phys = libevdev_get_phys(dev);
-        LLOG(LL_INFO, "device: %s , phys: %s", path, phys);
-        if (phys) {
-            return true;
-        }
+    // editors often replace the file instead of writing it, so watch its directory
+    auto slash      = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    if (inotify_add_watch(inotfd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        LLOG(LL_ERROR, "watch %s failed, %s", dir.c_str(), strerror(errno));
     }
-    return false;
+    LLOG(LL_INFO, "Watching %s", path.c_str());
+    thread = std::thread([this]() { run(); });
 }
 
-void watch_directory(int inotfd, const char* path) {
-    int watch_desc              = inotify_add_watch(inotfd, path, IN_CREATE);
-    size_t bufsiz               = sizeof(struct inotify_event) + PATH_MAX + 1;
-    struct inotify_event* event = (inotify_event*)malloc(bufsiz);
-
-    Defer free_defer{[&]() {
-        free(event);
-        inotify_rm_watch(inotfd, watch_desc);
-    }};
+ConfigWatcher::~ConfigWatcher() {
+    uint64_t one = 1;
+    write(stopfd, &one, sizeof(one));
+    thread.join();
+    delete pending.exchange(nullptr);
+    close(inotfd);
+    close(stopfd);
+    close(readyfd);
+}
 
-    while (1) {
-        /* wait for an event to occur */
-        read(inotfd, event, bufsiz);
-        LLOG(LL_INFO, "File %s be created", event->name);
+std::unique_ptr<Config> ConfigWatcher::take() {
+    uint64_t n;
+    read(readyfd, &n, sizeof(n));
+    return std::unique_ptr<Config>(pending.exchange(nullptr));
+}
 
-        std::string full_path = std::string(path) + event->name;
+void ConfigWatcher::run() {
+    auto slash       = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    alignas(inotify_event) char buf[4096];
 
-        // ignore device that phys is null, which maybe create by libudev
-        if (is_phys_not_null(full_path.c_str())) {
-            break;
+    while (true) {
+        pollfd fds[] = {{inotfd, POLLIN, 0}, {stopfd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            LLOG(LL_ERROR, "poll failed, %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+        ssize_t len = read(inotfd, buf, sizeof(buf));
+        bool changed = false;
+        for (char* p = buf; len > 0 && p < buf + len;) {
+            auto event = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+            if (event->len && name == event->name) {
+                changed = true;
+            }
+        }
+        if (changed) {
+            reload();
         }
     }
 }
 
-int inotfd = inotify_init();
-
-bool have_new_device() {
-    LLOG(LL_INFO, "Watching /dev/input/");
-    const char* path = "/dev/input/";
-    watch_directory(inotfd, path);
-    return true;
+void ConfigWatcher::reload() {
+    LLOG(LL_INFO, "%s changed, reload it", path.c_str());
+    try {
+        delete pending.exchange(new Config(load_config(path)));
+    } catch (const std::exception& e) {
+        LLOG(LL_ERROR, "invalid config, keep the old one: %s", e.what());
+        return;
+    } catch (ErrCode code) {
+        LLOG(LL_ERROR, "invalid config, keep the old one: error 0x%x", code);
+        return;
+    }
+    uint64_t one = 1;
+    write(readyfd, &one, sizeof(one));
 }
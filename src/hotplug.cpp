@@ -0,0 +1,52 @@
+#include "hotplug.h"
+#include "log.h"
+#include <cstdlib>
+#include <cstring>
+#include <libudev.h>
+
+HotplugMonitor::HotplugMonitor() {
+    udev = udev_new();
+    if (!udev) {
+        LLOG(LL_ERROR, "Can't create udev.");
+        exit(1);
+    }
+    monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (!monitor) {
+        LLOG(LL_ERROR, "Can't create udev monitor.");
+        exit(1);
+    }
+    udev_monitor_filter_add_match_subsystem_devtype(monitor, "input", nullptr);
+    if (udev_monitor_enable_receiving(monitor) < 0) {
+        LLOG(LL_ERROR, "Can't enable udev monitor.");
+        exit(1);
+    }
+    monitor_fd = udev_monitor_get_fd(monitor);
+}
+
+HotplugMonitor::~HotplugMonitor() {
+    udev_monitor_unref(monitor);
+    udev_unref(udev);
+}
+
+void HotplugMonitor::receive(const std::function<void(const HotplugEvent&)>& cb) {
+    while (struct udev_device* dev = udev_monitor_receive_device(monitor)) {
+        const char* action  = udev_device_get_action(dev);
+        const char* devnode = udev_device_get_devnode(dev);
+        const char* path    = udev_device_get_syspath(dev);
+        // only input nodes, and ignore virtual device which maybe create by libudev
+        const char* virtual_dev_prefix = "/sys/devices/virtual/";
+        if (action && devnode && path && strncmp(virtual_dev_prefix, path, strlen(virtual_dev_prefix))) {
+            const char* kbd = udev_device_get_property_value(dev, "ID_INPUT_KEYBOARD");
+            HotplugEvent event{
+                .added    = strcmp(action, "add") == 0,
+                .keyboard = kbd && strcmp(kbd, "1") == 0,
+                .id       = device_id(dev),
+            };
+            LLOG(LL_INFO, "udev %s: %s, keyboard: %d", action, devnode, event.keyboard);
+            if (event.added || strcmp(action, "remove") == 0) {
+                cb(event);
+            }
+        }
+        udev_device_unref(dev);
+    }
+}
@@ -0,0 +1,288 @@
+#include "keymap.h"
+#include "common.h"
+#include "err.h"
+#include "keys.h"
+#include "log.h"
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static uint key_of(std::string_view name) {
+    int code = key_code(name);
+    if (code < 0) {
+        LLOG(LL_ERROR, "unknown key: %.*s", int(name.size()), name.data());
+        throw UNKNOWN_KEY_ERROR;
+    }
+    return code;
+}
+
+static uint key_at(const nlohmann::json& v, const char* field) {
+    return key_of(v.at(field).get_ref<const std::string&>());
+}
+
+struct LayerCfg {
+    std::string name;
+    const nlohmann::json* v;
+    std::string parent = {};
+    uint depth         = 0;
+};
+
+static LayerCfg* find_layer(std::vector<LayerCfg>& cfgs, const std::string& name) {
+    auto it = std::find_if(cfgs.begin(), cfgs.end(), [&](auto& c) { return c.name == name; });
+    return it == cfgs.end() ? nullptr : &*it;
+}
+
+// Orders the layers so every layer comes after its parent, a layer with an
+// unknown parent or in a parent cycle makes the config invalid.
+static void sort_layers(std::vector<LayerCfg>& cfgs) {
+    for (auto& lc : cfgs) {
+        if (auto it = lc.v->find("parent"); it != lc.v->end()) {
+            lc.parent = it->get<std::string>();
+            if (!find_layer(cfgs, lc.parent)) {
+                LLOG(LL_ERROR, "layer %s: unknown parent layer %s", lc.name.c_str(), lc.parent.c_str());
+                throw LAYER_ERROR;
+            }
+        }
+    }
+    for (auto& lc : cfgs) {
+        for (auto* p = &lc; !p->parent.empty(); p = find_layer(cfgs, p->parent)) {
+            if (++lc.depth > cfgs.size()) {
+                LLOG(LL_ERROR, "layer %s: parent layers form a cycle", lc.name.c_str());
+                throw LAYER_ERROR;
+            }
+        }
+    }
+    std::stable_sort(cfgs.begin(), cfgs.end(), [](auto& a, auto& b) { return a.depth < b.depth; });
+}
+
+static void set_layer_entry(Keymap& km, uint layer, uint code, uint16_t to) {
+    km.layer_map[layer][code] = to;
+    km.layer_mask[code] |= 1 << layer;
+}
+
+// "meta" is a momentary layer with a click, kept for older configs.
+static void compile_layers(Keymap& km, std::vector<LayerCfg>& cfgs) {
+    sort_layers(cfgs);
+    if (cfgs.size() >= Keymap::MAX_LAYERS) {
+        LLOG(LL_ERROR, "too many layers: %zu, at most %u", cfgs.size(), Keymap::MAX_LAYERS - 1);
+        throw LAYER_ERROR;
+    }
+    for (uint l = 1; l <= cfgs.size(); l++) {
+        auto& lc     = cfgs[l - 1];
+        auto& v      = *lc.v;
+        auto& layer  = km.layers[l];
+        bool is_meta = v.at("type").get_ref<const std::string&>() == "meta";
+        layer.parent = lc.parent.empty() ? 0 : find_layer(cfgs, lc.parent) - cfgs.data() + 1;
+        auto mode    = v.value("mode", std::string("momentary"));
+        if (mode != "momentary" && mode != "toggle") {
+            LLOG(LL_ERROR, "layer %s: unknown mode %s", lc.name.c_str(), mode.c_str());
+            throw LAYER_ERROR;
+        }
+        layer.toggle = mode == "toggle";
+        if (is_meta || v.contains("click")) {
+            layer.has_click = !layer.toggle;
+            layer.click     = key_at(v, "click");
+        }
+
+        uint key = key_at(v, "key");
+        if (km.layer_mask[key] & (1 << layer.parent)) {
+            LLOG(LL_INFO, "layer %s: key %s is already used in its parent layer, overridden", lc.name.c_str(),
+                 key_name(key));
+        }
+        set_layer_entry(km, layer.parent, key, Keymap::LAYER_KEY | l);
+        if (auto it = v.find("mapping"); it != v.end()) {
+            for (auto&& [from, to] : it->items()) {
+                set_layer_entry(km, l, key_of(from), key_of(to.get_ref<const std::string&>()));
+            }
+        }
+    }
+    km.layer_cnt = cfgs.size() + 1;
+}
+
+static void compile_chord(Keymap& km, const std::string& name, const nlohmann::json& v) {
+    auto& keys = v.at("keys");
+    if (keys.size() < 2 || keys.size() > Keymap::MAX_CHORD_KEYS) {
+        LLOG(LL_ERROR, "chord %s: needs 2 to %u keys", name.c_str(), Keymap::MAX_CHORD_KEYS);
+        throw CHORD_ERROR;
+    }
+    if (km.chord_cnt == Keymap::MAX_CHORDS) {
+        LLOG(LL_ERROR, "too many chords, at most %u", Keymap::MAX_CHORDS);
+        throw CHORD_ERROR;
+    }
+    uint c      = km.chord_cnt++;
+    auto window = uint16_t(std::clamp(v.value("timeout", 50), 1, 0xffff));
+    for (auto& key : keys) {
+        uint code = key_of(key.get_ref<const std::string&>());
+        if (km.chord_mask[code][c]) {
+            LLOG(LL_ERROR, "chord %s: key %s twice", name.c_str(), key_name(code));
+            throw CHORD_ERROR;
+        }
+        km.role[code] |= Keymap::ROLE_CHORD;
+        km.chord_mask[code][c] = true;
+        km.chord_window[code]  = std::max(km.chord_window[code], window);
+    }
+    km.chord_size[keys.size()][c] = true;
+
+    km.chords[c].to   = key_at(v, "to");
+    km.chords[c].size = keys.size();
+}
+
+static void add_macro_step(Keymap& km, const std::string& name, Keymap::MacroStep step) {
+    if (km.macro_step_cnt == Keymap::MAX_MACRO_STEPS) {
+        LLOG(LL_ERROR, "macro %s: too many macro steps, at most %u in all", name.c_str(), Keymap::MAX_MACRO_STEPS);
+        throw MACRO_ERROR;
+    }
+    km.macro_steps[km.macro_step_cnt++] = step;
+}
+
+// a step is a key name to tap, or one of {"press": key}, {"release": key},
+// {"tap": key} and {"delay": ms}.
+static void compile_macro(Keymap& km, const std::string& name, const nlohmann::json& v) {
+    using Step = Keymap::MacroStep;
+    if (km.macro_cnt == Keymap::MAX_MACROS) {
+        LLOG(LL_ERROR, "too many macros, at most %u", Keymap::MAX_MACROS);
+        throw MACRO_ERROR;
+    }
+    uint key      = key_at(v, "key");
+    auto& macro   = km.macros[km.macro_cnt];
+    macro.first   = km.macro_step_cnt;
+    macro.pace_ms = std::clamp(v.value("pace", 5), 0, 0xffff);
+    for (auto& step : v.at("steps")) {
+        if (step.is_string() || step.contains("tap")) {
+            uint code = step.is_string() ? key_of(step.get_ref<const std::string&>()) : key_at(step, "tap");
+            add_macro_step(km, name, {Step::PRESS, uint16_t(code), 0});
+            add_macro_step(km, name, {Step::RELEASE, uint16_t(code), 0});
+        } else if (step.contains("press")) {
+            add_macro_step(km, name, {Step::PRESS, uint16_t(key_at(step, "press")), 0});
+        } else if (step.contains("release")) {
+            add_macro_step(km, name, {Step::RELEASE, uint16_t(key_at(step, "release")), 0});
+        } else if (step.contains("delay")) {
+            add_macro_step(km, name, {Step::DELAY, 0, uint16_t(std::clamp(step.at("delay").get<int>(), 0, 0xffff))});
+        } else {
+            LLOG(LL_ERROR, "macro %s: unknown step %s", name.c_str(), step.dump().c_str());
+            throw MACRO_ERROR;
+        }
+    }
+    macro.count = km.macro_step_cnt - macro.first;
+    km.role[key] |= Keymap::ROLE_MACRO;
+    km.macro_of[key] = km.macro_cnt++;
+}
+
+// "autorepeat" has the "delay" in ms and the "rate" per second of every key but
+// the buttons, and "keys" with those of single keys, a rate of 0 leaves the
+// key to the repeats of the devices.
+static void compile_autorepeat(Keymap& km, const nlohmann::json& v) {
+    if (!v.value("enable", true)) {
+        return;
+    }
+    int delay = std::clamp(v.value("delay", 250), 1, 0xffff);
+    int rate  = std::clamp(v.value("rate", 30), 0, 1000);
+    for (uint code = 0; code < KEY_CNT; code++) {
+        if (code < BTN_MISC || code >= KEY_OK) {
+            km.repeat_delay_ms[code] = delay;
+            km.repeat_rate[code]     = rate;
+        }
+    }
+    if (auto it = v.find("keys"); it != v.end()) {
+        for (auto&& [name, k] : it->items()) {
+            uint code                = key_of(name);
+            km.repeat_delay_ms[code] = std::clamp(k.value("delay", delay), 1, 0xffff);
+            km.repeat_rate[code]     = std::clamp(k.value("rate", rate), 0, 1000);
+        }
+    }
+}
+
+Keymap compile_keymap(const nlohmann::json& cfg) {
+    Keymap km;
+    std::vector<LayerCfg> layers;
+    if (auto it = cfg.find("mapping"); it != cfg.end()) {
+        for (auto&& [m_name, v] : it->items()) {
+            auto& typ = v.at("type").get_ref<const std::string&>();
+            if (!v.at("enable").get<bool>()) {
+                continue;
+            }
+            if (typ == "single") {
+                uint from = key_at(v, "from");
+                uint to   = key_at(v, "to");
+                km.role[from] |= Keymap::ROLE_SINGLE;
+                km.single[from] = to;
+            } else if (typ == "double") {
+                uint key = key_at(v, "key");
+                uint k1  = key_at(v, "click");
+                uint k2  = key_at(v, "press");
+                // the first double mapping of a key wins
+                if (km.is(key, Keymap::ROLE_DOUBLE)) {
+                    continue;
+                }
+                km.role[key] |= Keymap::ROLE_DOUBLE;
+                km.click[key]   = k1;
+                km.press[key]   = k2;
+                km.hold_ms[key] = std::clamp(v.value("timeout", 0), 0, 0xffff);
+            } else if (typ == "chord") {
+                compile_chord(km, m_name, v);
+            } else if (typ == "macro") {
+                compile_macro(km, m_name, v);
+            } else if (typ == "meta" || typ == "layer") {
+                layers.push_back({m_name, &v});
+            } else {
+                LLOG(LL_INFO, "unknown type:%s", typ.c_str());
+            }
+        }
+    }
+    compile_layers(km, layers);
+    if (auto it = cfg.find("autorepeat"); it != cfg.end()) {
+        compile_autorepeat(km, *it);
+    }
+    return km;
+}
+
+bool check_keymap(const Keymap& km) {
+    auto is_key = [](uint code) { return code < KEY_CNT; };
+    if (km.chord_cnt > Keymap::MAX_CHORDS || km.layer_cnt < 1 || km.layer_cnt > Keymap::MAX_LAYERS ||
+        km.macro_cnt > Keymap::MAX_MACROS || km.macro_step_cnt > Keymap::MAX_MACRO_STEPS) {
+        return false;
+    }
+    for (uint code = 0; code < KEY_CNT; code++) {
+        if (!is_key(km.single[code]) || !is_key(km.click[code]) || !is_key(km.press[code]) ||
+            km.layer_mask[code] >> km.layer_cnt || (km.chord_mask[code] >> km.chord_cnt).any() ||
+            (km.is(code, Keymap::ROLE_MACRO) && km.macro_of[code] >= km.macro_cnt) || km.repeat_rate[code] > 1000) {
+            return false;
+        }
+        for (uint l = 0; l < km.layer_cnt; l++) {
+            uint to    = km.layer_map[l][code];
+            uint layer = to & ~Keymap::LAYER_KEY;
+            if (to & Keymap::LAYER_KEY ? layer == 0 || layer >= km.layer_cnt : !is_key(to)) {
+                return false;
+            }
+        }
+    }
+    for (auto& size : km.chord_size) {
+        if ((size >> km.chord_cnt).any()) {
+            return false;
+        }
+    }
+    for (uint c = 0; c < km.chord_cnt; c++) {
+        auto& chord = km.chords[c];
+        if (chord.size < 2 || chord.size > Keymap::MAX_CHORD_KEYS || !is_key(chord.to)) {
+            return false;
+        }
+    }
+    // a parent comes before its layers
+    for (uint l = 1; l < km.layer_cnt; l++) {
+        if (km.layers[l].parent >= l || !is_key(km.layers[l].click)) {
+            return false;
+        }
+    }
+    for (uint m = 0; m < km.macro_cnt; m++) {
+        if (km.macros[m].first + km.macros[m].count > km.macro_step_cnt) {
+            return false;
+        }
+    }
+    for (uint i = 0; i < km.macro_step_cnt; i++) {
+        if (km.macro_steps[i].kind > Keymap::MacroStep::DELAY || !is_key(km.macro_steps[i].code)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -1,173 +1,136 @@
 #include "args.h"
 #include "common.h"
 #include "config.h"
+#include "config_cache.h"
+#include "device.h"
+#include "event_loop.h"
 #include "file_watch.h"
+#include "hotplug.h"
 #include "log.h"
 #include "mapper.h"
-#include <atomic>
-#include <fcntl.h>
-#include <functional>
-#include <libevdev/libevdev-uinput.h>
-#include <libevdev/libevdev.h>
-#include <libudev.h>
+#include "realtime.h"
+#include "record.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
 #include <string>
-#include <thread>
+#include <sys/signalfd.h>
 #include <unistd.h>
-#include <unordered_map>
-#include <utility>
 #include <vector>
 
-void send(const libevdev_uinput* uinput_dev, unsigned int type, unsigned int code, int value) {
-    LLOG(LL_DEBUG, "send: type:%d, code:%d, value:%d", type, code, value);
-    libevdev_uinput_write_event(uinput_dev, type, code, value);
-    libevdev_uinput_write_event(uinput_dev, EV_SYN, SYN_REPORT, 0);
-}
-
-void send(const libevdev_uinput* uinput_dev, input_event e) { send(uinput_dev, e.type, e.code, e.value); }
-
-void handle_input(const std::string path, SingleMapper& sm, DoubleMapper& dm, MetaMapper& mm) {
-    int fd = open(path.c_str(), O_RDONLY);
-    if (fd < 0) {
-        LLOG(LL_ERROR, "open file:%s failed.", path.c_str());
-        return;
-    }
-    Defer fd_defer{[&]() { close(fd); }};
-
-    libevdev* dev = nullptr;
-    Defer dev_defer{[&]() { libevdev_free(dev); }};
-    if (libevdev_new_from_fd(fd, &dev) < 0) {
-        LLOG(LL_ERROR, "create dev failed");
-        return;
-    }
-    sleep(1);
-
-    Defer grab_defer{[&]() { libevdev_grab(dev, LIBEVDEV_UNGRAB); }};
-    if (libevdev_grab(dev, LIBEVDEV_GRAB) < 0) {
-        LLOG(LL_ERROR, "grab dev failed");
-        return;
-    }
+// longest teardown after SIGINT/SIGTERM/SIGHUP
+static constexpr unsigned SHUTDOWN_TIMEOUT_S = 3;
 
-    int uifd = open("/dev/uinput", O_RDWR);
-    if (uifd < 0) {
-        LLOG(LL_ERROR, "open uinput file failed");
-        return;
-    }
-    Defer uifd_defer{[&]() { close(uifd); }};
-
-    struct libevdev_uinput* uidev = nullptr;
-    Defer uidev_defer{[&]() { libevdev_uinput_destroy(uidev); }};
-    if (libevdev_uinput_create_from_device(dev, uifd, &uidev) != 0) {
-        return;
-    }
-
-    while (true) {
-        struct input_event input;
-        int rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_NORMAL | LIBEVDEV_READ_FLAG_BLOCKING, &input);
-        while (rc == LIBEVDEV_READ_STATUS_SYNC) {
-            rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_SYNC, &input);
-        }
-        if (rc == -EAGAIN) {
-            continue;
-        }
-        if (rc != LIBEVDEV_READ_STATUS_SUCCESS) {
-            break;
-        }
-
-        if (input.type != EV_KEY) {
-            send(uidev, input);
-            continue;
-        }
-        LLOG(LL_DEBUG, "accept key: type:%d, code:%d, value:%d", input.type, input.code, input.value);
-        auto si = sm.map(input);
-        for (auto di : dm.map(si)) {
-            for (auto mi : mm.map(di)) {
-                send(uidev, mi);
-            }
-        }
+// the keyboards, or only conf_kbd when it's set
+std::vector<DeviceId> get_grab_kbds(const std::string& conf_kbd) {
+    if (!conf_kbd.empty()) {
+        return {device_id_of(conf_kbd)};
     }
-}
-
-std::vector<std::string> get_grab_kbds(std::string conf_kbd) {
-    std::vector<std::string> grab_kbds = get_kbd_devices();
+    std::vector<DeviceId> grab_kbds = get_kbd_devices();
     if (grab_kbds.size() == 0) {
         LLOG(LL_ERROR, "can't find out any key board device");
     }
 
-    if (!conf_kbd.empty()) {
-        if (std::find(grab_kbds.begin(), grab_kbds.end(), conf_kbd) == grab_kbds.end()) {
-            /* grab_kbds does not contain conf_kbd */
-            grab_kbds.push_back(conf_kbd);
-        }
-    }
-
     LLOG(LL_INFO, "get_grab_kbds size: %ld", grab_kbds.size());
     for (auto& kbd : grab_kbds) {
-        LLOG(LL_INFO, "kbd: %s", kbd.c_str());
+        LLOG(LL_INFO, "kbd: %s, name: %s", kbd.devnode.c_str(), kbd.name.c_str());
     }
     return grab_kbds;
 }
 
-void worker(std::atomic<bool>* is_finished, const std::string path, SingleMapper sm, DoubleMapper dm, MetaMapper mm) {
-    LLOG(LL_INFO, "worker %s begin", path.c_str());
-    try {
-        handle_input(path, sm, dm, mm);
-    } catch (const std::runtime_error& e) {
-        LLOG(LL_ERROR, "Caught std::runtime_error: %s", e.what());
-    } catch (...) { // Catch-all handler
-        LLOG(LL_ERROR, "Caught an unknown exception type.");
+void write_latency(const std::string& path, const json& latency) {
+    std::string s = latency.dump() + "\n";
+    if (path.empty()) {
+        fwrite(s.data(), 1, s.size(), stdout);
+        fflush(stdout);
+        return;
     }
-
-    is_finished->store(true);
-    LLOG(LL_INFO, "worker finished");
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        LLOG(LL_ERROR, "open file:%s failed.", path.c_str());
+        return;
+    }
+    fwrite(s.data(), 1, s.size(), f);
+    fclose(f);
 }
 
 int main(int argc, char* argv[]) {
     Args args(argc, argv);
-    GLOBAL_LOG_LEVEL  = args.log_level;
-    json cfg          = readConfig(args.config_path);
-    auto [sm, dm, mm] = get_mappers(cfg);
-    // Map of threads
-    std::unordered_map<std::string, std::pair<std::thread, std::atomic<bool>*>> thread_map;
-
-    std::vector<std::string> grab_kbds = get_grab_kbds(args.device);
-
-    for (auto& device : grab_kbds) {
-        auto is_finished = new std::atomic<bool>(false);
-        thread_map.insert({device, std::pair{std::thread(worker, is_finished, device, sm, dm, mm), is_finished}});
+    GLOBAL_LOG_LEVEL = args.log_level;
+
+    // handled by signalfd in the event loop, blocked before any thread starts
+    // so all of them inherit it
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+    log_start();
+    auto config = load_config(args.config_path);
+
+    // started first, the threads created later would inherit the policy and
+    // the cpus, only the event loop gets them, not the log or the config parsing
+    ConfigWatcher watcher(args.config_path);
+    apply_realtime(rt_options(config.compiled->realtime, args));
+
+    EventLoop loop;
+    if (args.io_uring && !loop.use_io_uring()) {
+        LLOG(LL_ERROR, "io_uring unavailable, using plain reads and writes");
     }
 
-    while (1) {
-        if (have_new_device()) {
-            // can't get new device if thread don't sleep
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-            LLOG(LL_INFO, "have a new input device!");
-
-            // remove terminated thread
-            std::erase_if(thread_map, [](auto& item) {
-                auto& [key, thread_bool_pair]  = item;
-                std::atomic<bool>* is_finished = thread_bool_pair.second;
-                if (is_finished->load()) {
-                    LLOG(LL_INFO, "%s's thread is terminated", key.c_str());
-                    delete is_finished;
-                    thread_bool_pair.first.join();
-                    return true;
-                }
-                return false;
-            });
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    Defer sigfd_defer{[&]() { close(sigfd); }};
+    // start monitoring before enumerating, so no device is missed in between
+    HotplugMonitor hotplug;
+    Recorder recorder;
+    if (!args.record_file.empty() && !recorder.open(args.record_file)) {
+        return 1;
+    }
+    DeviceTable devices(loop, config, recorder.is_open() ? &recorder : nullptr);
+    if (!devices.open()) {
+        return 1;
+    }
 
-            // reget kbds
-            grab_kbds = get_grab_kbds(args.device);
+    loop.add(sigfd, [&](uint32_t) {
+        signalfd_siginfo info;
+        if (read(sigfd, &info, sizeof(info)) != sizeof(info)) {
+            return;
+        }
+        if (info.ssi_signo == SIGUSR1) {
+            write_latency(args.latency_file, devices.latency());
+            return;
+        }
+        LLOG(LL_INFO, "caught signal %d, exit", info.ssi_signo);
+        // SIGALRM isn't blocked, it kills lanmai if the teardown hangs, the
+        // kernel then ungrabs the devices and destroys the virtual one
+        alarm(SHUTDOWN_TIMEOUT_S);
+        loop.stop();
+    });
+    for (auto& kbd : get_grab_kbds(args.device)) {
+        devices.add(kbd);
+    }
+    loop.add(hotplug.fd(), [&](uint32_t) {
+        hotplug.receive([&](const HotplugEvent& event) {
+            if (!event.added) {
+                devices.remove(event.id.devnode);
+            } else if (args.device.empty() ? event.keyboard : event.id.devnode == args.device) {
+                LLOG(LL_INFO, "have a new input device!");
+                devices.add(event.id);
+            }
+        });
+    });
 
-            // only handle new device
-            for (auto& device : grab_kbds) {
-                if (!thread_map.count(device)) {
-                    auto is_finished = new std::atomic<bool>(false);
-                    thread_map.insert(
-                        {device, std::pair{std::thread(worker, is_finished, device, sm, dm, mm), is_finished}});
-                }
+    loop.add(watcher.ready_fd(), [&](uint32_t) {
+        if (auto config = watcher.take(); config && !devices.reload(*config)) {
+            for (auto& kbd : get_grab_kbds(args.device)) {
+                devices.add(kbd);
             }
         }
-    }
+    });
 
+    loop.run();
     return 0;
 }
@@ -0,0 +1,44 @@
+#include "latency.h"
+
+uint64_t Histogram::count() const {
+    uint64_t n = 0;
+    for (auto& c : counts) {
+        n += c.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+uint64_t Histogram::quantile(double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+    auto rank   = std::max<uint64_t>(1, uint64_t(p * n + 0.5));
+    uint64_t at = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        at += counts[i].load(std::memory_order_relaxed);
+        if (at >= rank) {
+            return bucket_high(i);
+        }
+    }
+    return bucket_high(BUCKETS - 1);
+}
+
+nlohmann::json Histogram::to_json() const {
+    return {
+        {"count", count()},
+        {"p50_ns", quantile(0.5)},
+        {"p99_ns", quantile(0.99)},
+        {"p999_ns", quantile(0.999)},
+        {"max_ns", quantile(1)},
+    };
+}
+
+nlohmann::json LatencyStats::to_json() const {
+    return {
+        {"read", read.to_json()},
+        {"map", map.to_json()},
+        {"write", write.to_json()},
+        {"total", total.to_json()},
+    };
+}
@@ -0,0 +1,149 @@
+#include "log.h"
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+
+// Bounded MPSC ring, a slot's sequence tells who owns it: pos when free for
+// the producer of pos, pos + 1 once committed for the consumer.
+static constexpr size_t LOG_SLOTS = 512;
+static_assert((LOG_SLOTS & (LOG_SLOTS - 1)) == 0);
+
+static std::array<LogRecord, LOG_SLOTS> records;
+static std::array<std::atomic<size_t>, LOG_SLOTS> seqs;
+static std::atomic<size_t> enqueue_pos{0};
+static size_t dequeue_pos = 0;
+static std::atomic<uint64_t> dropped{0};
+
+static std::atomic<bool> running{false};
+static std::atomic<bool> stopping{false};
+static std::thread consumer;
+// the consumer blocks on it while the ring is empty, a producer wakes it only
+// when it's sleeping, so an idle lanmai doesn't wake up for the log
+static int wake_fd = -1;
+static std::atomic<bool> sleeping{false};
+
+static void wake() {
+    uint64_t one = 1;
+    write(wake_fd, &one, sizeof(one));
+}
+
+LogRecord* log_acquire() {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        size_t seq = seqs[pos & (LOG_SLOTS - 1)].load(std::memory_order_acquire);
+        auto diff  = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return &records[pos & (LOG_SLOTS - 1)];
+            }
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void log_commit(LogRecord* record) {
+    auto& seq = seqs[record - records.data()];
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    // pairs with the fence in consume(), either it sees the record or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false)) {
+        wake();
+    }
+}
+
+bool log_running() { return running.load(std::memory_order_relaxed); }
+
+static size_t drain() {
+    size_t n = 0;
+    while (true) {
+        auto& seq = seqs[dequeue_pos & (LOG_SLOTS - 1)];
+        if (seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            break;
+        }
+        LogRecord& record = records[dequeue_pos & (LOG_SLOTS - 1)];
+        record.format(stdout, record.site, record.payload);
+        seq.store(dequeue_pos + LOG_SLOTS, std::memory_order_release);
+        dequeue_pos++;
+        n++;
+    }
+    if (uint64_t d = dropped.exchange(0, std::memory_order_relaxed)) {
+        printf("[log] %lu records dropped, the ring was full\n", d);
+        n++;
+    }
+    return n;
+}
+
+static bool ring_empty() {
+    return seqs[dequeue_pos & (LOG_SLOTS - 1)].load(std::memory_order_acquire) != dequeue_pos + 1;
+}
+
+static void consume() {
+    // the signals lanmai handles go to its signalfd, none may land here
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    while (true) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        size_t n  = drain();
+        if (n) {
+            fflush(stdout);
+            continue;
+        }
+        if (stop) {
+            return;
+        }
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring_empty() && !stopping.load(std::memory_order_acquire)) {
+            uint64_t cnt;
+            read(wake_fd, &cnt, sizeof(cnt));
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+void log_start() {
+    if (running.load()) {
+        return;
+    }
+    for (size_t i = 0; i < LOG_SLOTS; i++) {
+        seqs[i].store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos = 0;
+    if (wake_fd < 0 && (wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        // records are formatted right away then
+        return;
+    }
+    stopping.store(false);
+    consumer = std::thread(consume);
+    running.store(true, std::memory_order_release);
+
+    static bool registered = false;
+    if (!registered) {
+        // exit() paths still flush what is queued
+        atexit(log_stop);
+        registered = true;
+    }
+}
+
+void log_stop() {
+    if (!running.load()) {
+        return;
+    }
+    // new records are formatted right away from now on
+    running.store(false);
+    stopping.store(true, std::memory_order_release);
+    wake();
+    consumer.join();
+    fflush(stdout);
+}
@@ -1,151 +1,474 @@
 #include "mapper.h"
 #include "common.h"
+#include "latency.h"
 #include "log.h"
+#include <algorithm>
+#include <bit>
 #include <linux/input.h>
 
 input_event SingleMapper::map(input_event input) {
-    if (auto it = keys.find(input.code); it != keys.end()) {
-        input.code = it->second;
-    }
+    input.code = km->single_of(input.code);
     return input;
 }
 
-// pressed_set as used to check a double key whether is a press key,
-//     when a double key and other keys pressed, the key will be treated as a
-//     press key.
-std::list<input_event> DoubleMapper::map(input_event input) {
-    std::list<input_event> res;
-    if (input.value == 1 && !pressed_set.empty()) {
-        for (auto v : pressed_set) {
-            auto ni           = input;
-            Info& info        = keys.at(v);
-            info.as_press_key = true;
-            ni.code           = info.press_key;
-            ni.value          = 1;
-            res.push_back(ni);
+void ChordMapper::map(input_event input, Events& out) {
+    // the window is over before the timer could tell
+    if (buffer_deadline && ns_of(input.time) >= buffer_deadline) {
+        resolve(out);
+    }
+    uint code     = input.code;
+    bool buffered = std::any_of(buffer.begin(), buffer.end(), [&](auto& bi) { return bi.code == code; });
+    // a release, of a buffered key before its chord was complete or of another
+    // key, can't overtake the buffered presses, the repeats of a buffered key
+    // are dropped with it
+    if (input.value != 1 && !(buffered && input.value == 2)) {
+        resolve(out);
+        buffered = false;
+    }
+    if (code >= KEY_CNT) {
+        out.push_back(input);
+        return;
+    }
+    if (held_for[code]) {
+        // a key of a fired chord, only the first release of them is sent
+        if (input.value == 0) {
+            uint c         = held_for[code] - 1;
+            held_for[code] = 0;
+            if (chord_down[c]-- == km->chords[c].size) {
+                input.code = km->chords[c].to;
+                out.push_back(input);
+            }
         }
-        pressed_set.clear();
-    }
-    auto it = keys.find(input.code);
-    if (it == keys.end()) {
-        res.push_back(input);
-        return res;
-    }
-    if (pressed_set.size() > 1) {
-        for (auto v : pressed_set) {
-            Info& info        = keys.at(v);
-            info.as_press_key = true;
-            input.code        = info.press_key;
-            input.value       = 1;
-            res.push_front(input);
+        return;
+    }
+    if (input.value == 1) {
+        press(input, out);
+    } else if (!buffered) {
+        out.push_back(input);
+    }
+}
+
+void ChordMapper::press(const input_event& input, Events& out) {
+    uint code = input.code;
+    if (!km->is(code, Keymap::ROLE_CHORD)) {
+        // it can't overtake the buffered keys
+        resolve(out);
+        out.push_back(input);
+        return;
+    }
+    auto next = buffer.empty() ? km->chord_mask[code] : candidates & km->chord_mask[code];
+    if (next.none()) {
+        // no chord has all of them, the key may still start another one
+        resolve(out);
+        next = km->chord_mask[code];
+    }
+    candidates = next;
+    buffer.push_back(input);
+    // the candidates all have the first key, so none has a longer window
+    uint first      = buffer[0].code;
+    buffer_deadline = ns_of(buffer[0].time) + km->chord_window[first] * 1000000ull;
+    // no longer chord left to wait for
+    if ((candidates & ~km->chord_size[buffer.size()]).none()) {
+        resolve(out);
+    }
+}
+
+void ChordMapper::expire(Events& out) { resolve(out); }
+
+void ChordMapper::resolve(Events& out) {
+    if (buffer.empty()) {
+        return;
+    }
+    auto exact = candidates & km->chord_size[buffer.size()];
+    if (exact.any()) {
+        // the first one of the config
+        uint c = 0;
+        while (!exact[c]) {
+            c++;
         }
-        pressed_set.clear();
+        fire(c, out);
+    } else {
+        for (auto& bi : buffer) {
+            out.push_back(bi);
+        }
+    }
+    buffer.clear();
+    candidates.reset();
+    buffer_deadline = 0;
+}
+
+void ChordMapper::fire(uint chord, Events& out) {
+    for (auto& bi : buffer) {
+        held_for[bi.code] = chord + 1;
     }
-    Info& info = it->second;
+    chord_down[chord] = buffer.size();
+
+    auto ci  = buffer[buffer.size() - 1];
+    ci.code  = km->chords[chord].to;
+    ci.value = 1;
+    out.push_back(ci);
+}
+
+// pending is used to check a double key whether is a press key,
+//     when a double key and other keys pressed, the key will be treated as a
+//     press key.
+void DoubleMapper::map(input_event input, Events& out) {
+    // the deadline passed before the timer could tell
+    if (pending_deadline && ns_of(input.time) >= pending_deadline) {
+        expire(out);
+    }
+    if (input.value == 1 && pending != NONE) {
+        resolve_pending(input, out);
+    }
+    if (!km->is(input.code, Keymap::ROLE_DOUBLE)) {
+        out.push_back(input);
+        return;
+    }
+    uint code = input.code;
     if (input.value == 1) {
-        info.pressed = true;
-        pressed_set.insert(it->first);
+        pending = code;
+        if (km->hold_ms[code]) {
+            pending_deadline = ns_of(input.time) + km->hold_ms[code] * 1000000ull;
+        }
     } else if (input.value == 2) {
-        if (info.as_press_key) {
-            input.code = info.press_key;
-            res.push_back(input);
+        if (as_press_key[code]) {
+            input.code = km->press[code];
+            out.push_back(input);
         }
-    } else if (!info.as_press_key) {
-        input.code = info.click_key;
-        res.push_back(input);
+    } else if (!as_press_key[code]) {
+        input.code  = km->click[code];
         input.value = 1;
-        res.push_front(input);
-        info.pressed = false;
-        pressed_set.clear();
+        out.push_back(input);
+        input.value = 0;
+        out.push_back(input);
+        pending          = NONE;
+        pending_deadline = 0;
     } else {
-        input.code  = info.press_key;
+        input.code  = km->press[code];
         input.value = 0;
-        res.push_back(input);
-        info.as_press_key = false;
-        info.pressed      = false;
+        out.push_back(input);
+        as_press_key[code] = false;
     }
-    return res;
 }
 
-std::list<input_event> MetaMapper::map(input_event input) {
-    std::list<input_event> res;
-    if (input.code == key) {
-        if (!as_meta_key) {
-            if (!pressed && input.value == 1) {
-                pressed = true;
-            } else if (pressed && input.value == 0) {
-                input.code = click_key;
-                res.push_back(input);
-                input.value = 1;
-                res.push_front(input);
-                pressed = false;
-            }
-        } else if (input.value == 0) {
-            pressed     = false;
-            as_meta_key = false;
-            for (auto i : mapped_inputs) {
-                i.value = 0;
-                res.push_back(i);
+void DoubleMapper::expire(Events& out) {
+    if (pending == NONE) {
+        return;
+    }
+    input_event at{};
+    at.time.tv_sec  = pending_deadline / 1000000000;
+    at.time.tv_usec = pending_deadline % 1000000000 / 1000;
+    at.type         = EV_KEY;
+    resolve_pending(at, out);
+}
+
+void DoubleMapper::resolve_pending(input_event at, Events& out) {
+    as_press_key[pending] = true;
+    at.code               = km->press[pending];
+    at.value              = 1;
+    out.push_back(at);
+    pending          = NONE;
+    pending_deadline = 0;
+}
+
+void LayerMapper::map(input_event input, Events& out) {
+    uint code = input.code;
+    if (code >= KEY_CNT) {
+        out.push_back(input);
+        return;
+    }
+    if (input.value == 1) {
+        // any press uses the held layer key as a layer key
+        tap = -1;
+        press(input, out);
+    } else if (input.value == 2) {
+        uint16_t as = pressed_as[code];
+        if (as == NONE) {
+            out.push_back(input);
+        } else if (as < KEY_CNT) {
+            input.code = as;
+            out.push_back(input);
+        }
+    } else {
+        release(input, out);
+    }
+}
+
+void LayerMapper::press(input_event input, Events& out) {
+    uint code   = input.code;
+    uint16_t in = km->layer_mask[code] & effective;
+    uint layer  = in ? std::bit_width(in) - 1 : 0;
+    uint16_t as = in ? km->layer_map[layer][code] : code;
+    // pressed again as the same plain key, e.g. by two source keys mapped to
+    // the same code, it's sent as it is and either release releases it
+    if (pressed_as[code] == as && pressed_in[code] == layer && !(as & Keymap::LAYER_KEY)) {
+        input.code = as;
+        out.push_back(input);
+        return;
+    }
+    // pressed again as something else, undo the first press so its layer or
+    // key can't be left on
+    if (pressed_as[code] != NONE && pressed_as[code] != RELEASED) {
+        auto ri  = input;
+        ri.value = 0;
+        release(ri, out);
+    }
+    pressed_as[code] = as;
+    pressed_in[code] = layer;
+
+    if (as & Keymap::LAYER_KEY) {
+        uint l = as & ~Keymap::LAYER_KEY;
+        if (km->layers[l].toggle) {
+            active ^= 1 << l;
+        } else {
+            active |= 1 << l;
+            if (km->layers[l].has_click) {
+                tap = l;
             }
-            mapped_inputs.clear();
         }
-        return res;
+        update(input, out);
+        return;
+    }
+    if (layer > 0 && !held.push_back(code)) {
+        LLOG(LL_ERROR, "too many mapped keys held, key:%d won't be released with its layer", code);
+    }
+    input.code = as;
+    out.push_back(input);
+}
+
+void LayerMapper::release(input_event input, Events& out) {
+    uint code        = input.code;
+    uint16_t as      = pressed_as[code];
+    pressed_as[code] = NONE;
+    if (as == RELEASED) {
+        return;
+    }
+    if (as == NONE) {
+        out.push_back(input);
+        return;
     }
-    if (pressed) {
-        if (input.value == 1) {
-            as_meta_key = true;
+    if (as & Keymap::LAYER_KEY) {
+        uint l = as & ~Keymap::LAYER_KEY;
+        if (km->layers[l].toggle) {
+            return;
         }
-        if (as_meta_key) {
-            auto it = keys.find(input.code);
-            if (it != keys.end()) {
-                input.code = it->second;
-                if (input.value == 1) {
-                    mapped_inputs.push_back(input);
-                }
-            }
+        active &= ~(1 << l);
+        if (tap == int(l)) {
+            input.code  = km->layers[l].click;
+            input.value = 1;
+            out.push_back(input);
+            input.value = 0;
+            out.push_back(input);
+            tap = -1;
         }
+        update(input, out);
+        return;
+    }
+    forget(code);
+    input.code = as;
+    out.push_back(input);
+}
+
+// recomputes the effective layers after a layer switch, and releases the keys
+// pressed through a layer that went off.
+void LayerMapper::update(const input_event& input, Events& out) {
+    uint16_t eff = 1;
+    for (uint l = 1; l < km->layer_cnt; l++) {
+        if ((active >> l & 1) && (eff >> km->layers[l].parent & 1)) {
+            eff |= 1 << l;
+        }
+    }
+    effective = eff;
+
+    size_t i = 0;
+    while (i < held.size()) {
+        uint code = held[i];
+        if (eff >> pressed_in[code] & 1) {
+            i++;
+            continue;
+        }
+        auto ri  = input;
+        ri.code  = pressed_as[code];
+        ri.value = 0;
+        out.push_back(ri);
+        pressed_as[code] = RELEASED;
+        held.erase(i);
+    }
+}
+
+void LayerMapper::forget(uint code) {
+    for (size_t i = 0; i < held.size(); i++) {
+        if (held[i] == code) {
+            held.erase(i);
+            return;
+        }
+    }
+}
+
+void MacroMapper::map(input_event input, Events& out) {
+    if (!km->is(input.code, Keymap::ROLE_MACRO)) {
+        out.push_back(input);
+        return;
+    }
+    // the macro key itself is never sent
+    if (input.value != 1) {
+        return;
+    }
+    uint m = km->macro_of[input.code];
+    if (!playing) {
+        start(m, ns_of(input.time));
+        play(ns_of(input.time), out);
+    } else if (!queued.push_back(m)) {
+        LLOG(LL_ERROR, "too many macros queued, drop the macro of key:%d", input.code);
     }
-    res.push_back(input);
-    return res;
 }
 
-std::tuple<SingleMapper, DoubleMapper, MetaMapper> get_mappers(const nlohmann::json& cfg) {
-    SingleMapper sm;
-    DoubleMapper dm;
-    MetaMapper mm;
-    if (auto it = cfg.find("mapping"); it != cfg.end()) {
-        for (auto&& [m_name, v] : it->items()) {
-            auto typ = v.at("type").get<std::string>();
-            if (!v.at("enable").get<bool>()) {
-                continue;
+void MacroMapper::start(uint m, uint64_t at_ns) {
+    playing = true;
+    macro   = m;
+    step    = 0;
+    next_at = at_ns;
+}
+
+void MacroMapper::expire(uint64_t now_ns, Events& out) { play(now_ns, out); }
+
+// sends the steps due at now_ns. A paced event ends the call, so it gets a
+// frame of its own; so does a full out, the rest is due right away.
+void MacroMapper::play(uint64_t now_ns, Events& out) {
+    while (playing && next_at <= now_ns && !out.full()) {
+        auto& m       = km->macros[macro];
+        auto* steps   = &km->macro_steps[m.first];
+        auto is_delay = [&](uint i) { return i < m.count && steps[i].kind == Keymap::MacroStep::DELAY; };
+
+        if (is_delay(step)) {
+            next_at = now_ns + steps[step++].delay_ms * 1000000ull;
+        } else if (step < m.count) {
+            auto& s = steps[step++];
+            input_event e{};
+            e.time.tv_sec  = now_ns / 1000000000;
+            e.time.tv_usec = now_ns % 1000000000 / 1000;
+            e.type         = EV_KEY;
+            e.code         = s.code;
+            e.value        = s.kind;
+            out.push_back(e);
+
+            // delays right after the event replace the pace
+            uint64_t wait_ms = is_delay(step) ? 0 : m.pace_ms;
+            while (is_delay(step)) {
+                wait_ms += steps[step++].delay_ms;
             }
-            if (typ == "single") {
-                uint from = TABLE.at(v.at("from").get<std::string>());
-                uint to   = TABLE.at(v.at("to").get<std::string>());
-                sm.add_key(from, to);
-            } else if (typ == "double") {
-                uint key = TABLE.at(v.at("key").get<std::string>());
-                uint k1  = TABLE.at(v.at("click").get<std::string>());
-                uint k2  = TABLE.at(v.at("press").get<std::string>());
-                dm.add_key(key, k1, k2);
-            } else if (typ == "meta") {
-                if (!mm.empty()) {
-                    LLOG(LL_INFO, "don't support multi meta key yet, ignore %s", m_name.c_str());
-                    continue;
-                }
-                uint key   = TABLE.at(v.at("key").get<std::string>());
-                uint click = TABLE.at(v.at("click").get<std::string>());
-                std::map<uint, uint> meta_keys;
-                for (auto&& [from, to] : v.at("mapping").items()) {
-                    uint fv       = TABLE.at(from);
-                    uint tv       = TABLE.at(to.get<std::string>());
-                    meta_keys[fv] = tv;
-                }
-                mm = MetaMapper(key, click, meta_keys);
-            } else {
-                LLOG(LL_INFO, "unknown type:%s", typ.c_str());
+            if (wait_ms) {
+                next_at = now_ns + wait_ms * 1000000;
+            }
+        }
+        if (step == m.count) {
+            playing = false;
+            if (!queued.empty()) {
+                start(queued[0], next_at);
+                queued.erase(0);
             }
         }
     }
-    return {sm, dm, mm};
+}
+
+void RepeatMapper::map(input_event input, Events& out) {
+    bool own = km->repeats(input.code);
+    if (input.value == 2 && own) {
+        return;
+    }
+    if (input.value == 1) {
+        // a press ends the repeat of the key before, repeating or not itself
+        repeating = own ? input.code : NONE;
+        next_at   = own ? ns_of(input.time) + km->repeat_delay_ms[input.code] * 1000000ull : 0;
+    } else if (input.value == 0 && input.code == repeating) {
+        repeating = NONE;
+    }
+    out.push_back(input);
+}
+
+void RepeatMapper::expire(uint64_t now_ns, Events& out) {
+    if (repeating == NONE || next_at > now_ns) {
+        return;
+    }
+    input_event e{};
+    e.time.tv_sec  = now_ns / 1000000000;
+    e.time.tv_usec = now_ns % 1000000000 / 1000;
+    e.type         = EV_KEY;
+    e.code         = repeating;
+    e.value        = 2;
+    out.push_back(e);
+    // the next ones stay at the times from the first, a late wakeup doesn't
+    // shift them, but the repeats missed by a long stall aren't made up
+    uint64_t interval = 1000000000 / km->repeat_rate[repeating];
+    next_at += interval;
+    if (next_at <= now_ns) {
+        next_at = now_ns + interval;
+    }
+}
+
+Mappers get_mappers(std::shared_ptr<const Keymap> km) {
+    return {SingleMapper(km), ChordMapper(km), DoubleMapper(km), LayerMapper(km), MacroMapper(km), RepeatMapper(km)};
+}
+
+Mappers get_mappers(const nlohmann::json& cfg) { return get_mappers(std::make_shared<const Keymap>(compile_keymap(cfg))); }
+
+const Events& Pipeline::map(const input_event& input) {
+    cm_out.clear();
+    dm_out.clear();
+    lm_out.clear();
+    mm_out.clear();
+    out.clear();
+    cm.map(sm.map(input), cm_out);
+    for (auto& ci : cm_out) {
+        dm.map(ci, dm_out);
+    }
+    for (auto& di : dm_out) {
+        lm.map(di, lm_out);
+    }
+    for (auto& li : lm_out) {
+        mm.map(li, mm_out);
+    }
+    for (auto& mi : mm_out) {
+        rm.map(mi, out);
+    }
+    return out;
+}
+
+uint64_t Pipeline::deadline() const {
+    uint64_t res = 0;
+    for (uint64_t d : {cm.deadline(), dm.deadline(), mm.deadline(), rm.deadline()}) {
+        if (d && (!res || d < res)) {
+            res = d;
+        }
+    }
+    return res;
+}
+
+const Events& Pipeline::expire(uint64_t now_ns) {
+    cm_out.clear();
+    dm_out.clear();
+    lm_out.clear();
+    mm_out.clear();
+    out.clear();
+    if (cm.deadline() && cm.deadline() <= now_ns) {
+        cm.expire(cm_out);
+    }
+    for (auto& ci : cm_out) {
+        dm.map(ci, dm_out);
+    }
+    if (dm.deadline() && dm.deadline() <= now_ns) {
+        dm.expire(dm_out);
+    }
+    for (auto& di : dm_out) {
+        lm.map(di, lm_out);
+    }
+    for (auto& li : lm_out) {
+        mm.map(li, mm_out);
+    }
+    mm.expire(now_ns, mm_out);
+    for (auto& mi : mm_out) {
+        rm.map(mi, out);
+    }
+    rm.expire(now_ns, out);
+    return out;
 }
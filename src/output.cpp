@@ -0,0 +1,62 @@
+#include "output.h"
+#include "log.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+void Output::push(const input_event& e) {
+    if (!keys.apply(e)) {
+        LLOG(LL_DEBUG, "drop redundant: code:%d, value:%d", e.code, e.value);
+        return;
+    }
+    LLOG(LL_DEBUG, "send: type:%d, code:%d, value:%d", e.type, e.code, e.value);
+    if (frame.size() == MAX_FRAME_EVENTS) {
+        flush();
+    }
+    frame.push_back(e);
+}
+
+void Output::push(unsigned int type, unsigned int code, int value) {
+    input_event e{};
+    e.type  = type;
+    e.code  = code;
+    e.value = value;
+    push(e);
+}
+
+bool Output::flush() {
+    if (frame.empty()) {
+        return false;
+    }
+    input_event syn{};
+    syn.type  = EV_SYN;
+    syn.code  = SYN_REPORT;
+    syn.value = 0;
+    frame.push_back(syn);
+
+    size_t len = frame.size() * sizeof(input_event);
+    if (uring) {
+        uring->write(fd, frame.data(), len);
+        frame.clear();
+        return true;
+    }
+    ssize_t rc = write(fd, frame.data(), len);
+    if (rc < 0) {
+        LLOG(LL_ERROR, "write uinput failed, %s", strerror(errno));
+    } else if (size_t(rc) != len) {
+        LLOG(LL_ERROR, "short write to uinput, %ld of %ld bytes", rc, len);
+    }
+    frame.clear();
+    return true;
+}
+
+uint Output::release_all() {
+    uint n = 0;
+    // push() clears the keys of the copy it walks
+    KeyState down = keys;
+    down.for_each([&](uint code) {
+        push(EV_KEY, code, 0);
+        n++;
+    });
+    return n;
+}
@@ -0,0 +1,59 @@
+#include "profile.h"
+#include "err.h"
+#include "log.h"
+#include <cstring>
+#include <fnmatch.h>
+
+template <size_t N> static void copy_field(char (&to)[N], const std::string& from, const char* profile) {
+    if (from.size() >= N) {
+        LLOG(LL_ERROR, "profile %s: %s is too long, at most %zu chars", profile, from.c_str(), N - 1);
+        throw PROFILE_ERROR;
+    }
+    memcpy(to, from.c_str(), from.size() + 1);
+}
+
+static int32_t id_of(const nlohmann::json& match, const char* field, const char* profile) {
+    auto it = match.find(field);
+    if (it == match.end()) {
+        return -1;
+    }
+    auto& s = it->get_ref<const std::string&>();
+    char* end;
+    long id = strtol(s.c_str(), &end, 16);
+    if (s.empty() || *end || id < 0 || id > 0xffff) {
+        LLOG(LL_ERROR, "profile %s: invalid id %s, 4 hex digits", profile, s.c_str());
+        throw PROFILE_ERROR;
+    }
+    return id;
+}
+
+// "match" has "vendor" and "product" in hex, as --list-kbd-devices shows
+// them, and "name" and "phys" patterns, a device has to match all it has.
+ProfileMatch compile_profile_match(const std::string& name, const nlohmann::json& v) {
+    ProfileMatch profile{};
+    copy_field(profile.name, name, name.c_str());
+    auto& match     = v.at("match");
+    profile.vendor  = id_of(match, "vendor", profile.name);
+    profile.product = id_of(match, "product", profile.name);
+    copy_field(profile.device_name, match.value("name", std::string()), profile.name);
+    copy_field(profile.phys, match.value("phys", std::string()), profile.name);
+    profile.exclude = v.value("exclude", false);
+    return profile;
+}
+
+static bool matches_pattern(const char* pattern, const std::string& s) {
+    return !*pattern || fnmatch(pattern, s.c_str(), 0) == 0;
+}
+
+bool matches(const ProfileMatch& profile, const DeviceId& id) {
+    return (profile.vendor < 0 || profile.vendor == id.vendor) &&
+           (profile.product < 0 || profile.product == id.product) && matches_pattern(profile.device_name, id.name) &&
+           matches_pattern(profile.phys, id.phys);
+}
+
+bool check_profile(const ProfileMatch& profile) {
+    auto terminated = [](auto& s) { return memchr(s, 0, sizeof(s)) != nullptr; };
+    auto is_id      = [](int32_t id) { return id >= -1 && id <= 0xffff; };
+    return terminated(profile.name) && terminated(profile.device_name) && terminated(profile.phys) &&
+           is_id(profile.vendor) && is_id(profile.product);
+}
@@ -0,0 +1,136 @@
+#include "realtime.h"
+#include "log.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// what the event loop may use of its stack, touched once so it's resident
+static constexpr size_t STACK_PREFAULT = 256 * 1024;
+
+bool parse_cpus(const std::string& s, cpu_set_t& cpus) {
+    CPU_ZERO(&cpus);
+    const char* p = s.c_str();
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last  = first;
+        if (end == p) {
+            return false;
+        }
+        p = end;
+        if (*p == '-') {
+            last = strtol(++p, &end, 10);
+            if (end == p) {
+                return false;
+            }
+            p = end;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return false;
+        }
+    }
+    return CPU_COUNT(&cpus) > 0;
+}
+
+static int policy_of(const std::string& name) {
+    if (name == "fifo") {
+        return SCHED_FIFO;
+    }
+    if (name == "rr") {
+        return SCHED_RR;
+    }
+    if (name != "other") {
+        LLOG(LL_ERROR, "realtime: unknown policy %s, fifo/rr/other", name.c_str());
+    }
+    return SCHED_OTHER;
+}
+
+RtOptions rt_config(const nlohmann::json& cfg) {
+    RtOptions opts;
+    if (auto it = cfg.find("realtime"); it != cfg.end()) {
+        opts.policy      = policy_of(it->value("policy", std::string("other")));
+        opts.priority    = it->value("priority", opts.priority);
+        opts.lock_memory = it->value("lock_memory", false);
+        if (auto cpus = it->find("cpus"); cpus != it->end() && !parse_cpus(cpus->get<std::string>(), opts.cpus)) {
+            LLOG(LL_ERROR, "realtime: invalid cpus %s", cpus->get_ref<const std::string&>().c_str());
+        }
+    }
+    return opts;
+}
+
+RtOptions rt_options(RtOptions opts, const Args& args) {
+    if (!args.rt_policy.empty()) {
+        opts.policy = policy_of(args.rt_policy);
+    }
+    if (args.rt_priority >= 0) {
+        opts.priority = args.rt_priority;
+    }
+    opts.lock_memory |= args.lock_memory;
+    if (!args.cpus.empty() && !parse_cpus(args.cpus, opts.cpus)) {
+        LLOG(LL_ERROR, "realtime: invalid cpus %s", args.cpus.c_str());
+    }
+    return opts;
+}
+
+static void prefault_stack() {
+    volatile char stack[STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+bool apply_realtime(const RtOptions& opts) {
+    bool ok = true;
+    if (opts.lock_memory) {
+        // locked before the stack is touched, so its pages stay
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+            int err = errno;
+            LLOG(LL_ERROR, "realtime: mlockall failed, %s, it needs CAP_IPC_LOCK or a RLIMIT_MEMLOCK large enough",
+                 strerror(err));
+            ok = false;
+        } else {
+            prefault_stack();
+            LLOG(LL_INFO, "realtime: memory locked");
+        }
+    }
+
+    if (CPU_COUNT(&opts.cpus)) {
+        if (int err = pthread_setaffinity_np(pthread_self(), sizeof(opts.cpus), &opts.cpus)) {
+            LLOG(LL_ERROR, "realtime: pinning to cpus failed, %s, are they online and allowed?", strerror(err));
+            ok = false;
+        } else {
+            LLOG(LL_INFO, "realtime: pinned to %d cpus", CPU_COUNT(&opts.cpus));
+        }
+    }
+
+    if (opts.policy != SCHED_OTHER) {
+        const char* name = opts.policy == SCHED_FIFO ? "fifo" : "rr";
+        int min          = sched_get_priority_min(opts.policy);
+        int max          = sched_get_priority_max(opts.policy);
+        if (opts.priority < min || opts.priority > max) {
+            LLOG(LL_ERROR, "realtime: priority %d out of %d..%d for %s", opts.priority, min, max, name);
+            return false;
+        }
+        sched_param param{};
+        param.sched_priority = opts.priority;
+        if (int err = pthread_setschedparam(pthread_self(), opts.policy, &param)) {
+            LLOG(LL_ERROR, "realtime: setting %s priority %d failed, %s, it needs CAP_SYS_NICE or a RLIMIT_RTPRIO of "
+                           "at least %d",
+                 name, opts.priority, strerror(err), opts.priority);
+            ok = false;
+        } else {
+            LLOG(LL_INFO, "realtime: running %s at priority %d", name, opts.priority);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,81 @@
+#include "record.h"
+#include "log.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'L', 'A', 'N', 'M', 'A', 'I', 'R', '1'};
+
+input_event RecordEvent::to_input() const {
+    input_event e{};
+    e.time.tv_sec  = time_ns / 1000000000;
+    e.time.tv_usec = time_ns % 1000000000 / 1000;
+    e.type         = type;
+    e.code         = code;
+    e.value        = value;
+    return e;
+}
+
+RecordEvent RecordEvent::from_input(uint8_t device, const input_event& e) {
+    return {
+        .time_ns = uint64_t(e.time.tv_sec) * 1000000000 + uint64_t(e.time.tv_usec) * 1000,
+        .value   = e.value,
+        .code    = e.code,
+        .type    = uint8_t(e.type),
+        .device  = device,
+    };
+}
+
+bool Recorder::open(const std::string& path) {
+    // every key typed, passwords included, only its owner may read it, an
+    // existing file keeps its mode on open, so it's set again
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || fchmod(fd, 0600) < 0 || !(file = fdopen(fd, "wb"))) {
+        LLOG(LL_ERROR, "open file:%s failed, %s", path.c_str(), strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    // keep writes out of the event path, flushed when full or closed
+    setvbuf(file, nullptr, _IOFBF, 1 << 16);
+    fwrite(MAGIC, 1, sizeof(MAGIC), file);
+    return true;
+}
+
+void Recorder::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+void Recorder::write(const RecordEvent& e) {
+    if (file) {
+        fwrite(&e, sizeof(e), 1, file);
+    }
+}
+
+RecordReader::~RecordReader() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool RecordReader::open(const std::string& path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        LLOG(LL_ERROR, "open file:%s failed.", path.c_str());
+        return false;
+    }
+    char magic[sizeof(MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(MAGIC))) {
+        LLOG(LL_ERROR, "%s is not a lanmai record file", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RecordReader::next(RecordEvent& e) { return fread(&e, sizeof(e), 1, file) == 1; }
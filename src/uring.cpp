@@ -0,0 +1,286 @@
+#include "uring.h"
+#include "event_loop.h"
+#include "latency.h"
+#include "log.h"
+
+#ifdef LANMAI_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <liburing.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// in flight at once, reads of every device and the writes of a batch
+static constexpr unsigned RING_ENTRIES = 256;
+// the largest write, a full Output frame
+static constexpr size_t MAX_WRITE = 8192;
+// a read takes at most that much in one go
+static constexpr size_t MAX_READ = 4096;
+// finish_writes() waits at most that long
+static constexpr long FINISH_TIMEOUT_NS = 100 * 1000000;
+
+struct Uring::ReadOp {
+    int fd;
+    size_t len;
+    ReadCallback cb;
+    // the user data of the poll or read the kernel holds, 0 if none
+    uint64_t in_flight = 0;
+    bool cancelled     = false;
+    // a read of the drained fd returned -EAGAIN, instead of the kernel waiting
+    // for data itself as recent ones do, it's polled for once drained
+    bool polled = false;
+    alignas(16) char buf[MAX_READ];
+};
+
+struct Uring::WriteOp {
+    bool busy = false;
+    size_t len;
+    alignas(16) char buf[MAX_WRITE];
+};
+
+// the user data of a request is its op, the low bits tell which one, the
+// completions of cancel requests are ignored.
+static constexpr uint64_t CANCEL_DATA = 0;
+static constexpr uint64_t POLL_TAG    = 1;
+static constexpr uint64_t WRITE_TAG   = 2;
+static constexpr uint64_t TAGS        = 3;
+
+std::unique_ptr<Uring> Uring::create(EventLoop& loop) {
+    auto ring = new io_uring;
+    if (int err = io_uring_queue_init(RING_ENTRIES, ring, 0); err < 0) {
+        LLOG(LL_ERROR, "io_uring setup failed, %s", strerror(-err));
+        delete ring;
+        return nullptr;
+    }
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0 || io_uring_register_eventfd(ring, efd) < 0) {
+        LLOG(LL_ERROR, "io_uring eventfd failed, %s", strerror(errno));
+        if (efd >= 0) {
+            close(efd);
+        }
+        io_uring_queue_exit(ring);
+        delete ring;
+        return nullptr;
+    }
+    return std::unique_ptr<Uring>(new Uring(loop, ring, efd));
+}
+
+Uring::Uring(EventLoop& loop, io_uring* ring, int efd) : loop(loop), ring(ring), efd(efd) {
+    loop.add(efd, [this](uint32_t) { reap(); });
+}
+
+Uring::~Uring() {
+    loop.remove(efd);
+    // cancels what is still posted, the buffers are freed after it
+    io_uring_queue_exit(ring);
+    delete ring;
+    close(efd);
+}
+
+io_uring_sqe* Uring::get_sqe() {
+    io_uring_sqe* sqe = io_uring_get_sqe(ring);
+    if (!sqe) {
+        // the ring is full, what is queued goes now
+        submit();
+        sqe = io_uring_get_sqe(ring);
+    }
+    return sqe;
+}
+
+// the fds are non-blocking, a read may return -EAGAIN once they're drained, a
+// poll waits for the next events then.
+void Uring::post(ReadOp* op, bool poll) {
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        LLOG(LL_ERROR, "io_uring full, read of fd:%d dropped", op->fd);
+        return;
+    }
+    if (poll) {
+        io_uring_prep_poll_add(sqe, op->fd, POLLIN);
+        op->in_flight = uint64_t(op) | POLL_TAG;
+    } else {
+        io_uring_prep_read(sqe, op->fd, op->buf, op->len, 0);
+        op->in_flight = uint64_t(op);
+    }
+    io_uring_sqe_set_data64(sqe, op->in_flight);
+    queued = true;
+}
+
+Uring::ReadOp* Uring::read(int fd, size_t len, ReadCallback cb) {
+    auto op = std::make_unique<ReadOp>();
+    op->fd  = fd;
+    op->len = std::min(len, MAX_READ);
+    op->cb  = std::move(cb);
+    post(op.get(), false);
+    reads.push_back(std::move(op));
+    return reads.back().get();
+}
+
+void Uring::cancel(ReadOp* op) {
+    op->cancelled = true;
+    if (!op->in_flight) {
+        // from its callback, reap() frees it
+        return;
+    }
+    if (io_uring_sqe* sqe = get_sqe()) {
+        io_uring_prep_cancel64(sqe, op->in_flight, 0);
+        io_uring_sqe_set_data64(sqe, CANCEL_DATA);
+        queued = true;
+    }
+}
+
+void Uring::write(int fd, const void* data, size_t len) {
+    if (len > MAX_WRITE) {
+        LLOG(LL_ERROR, "io_uring write of %zu bytes, at most %zu", len, MAX_WRITE);
+        return;
+    }
+    auto it = std::find_if(writes.begin(), writes.end(), [](auto& w) { return !w->busy; });
+    if (it == writes.end()) {
+        writes.push_back(std::make_unique<WriteOp>());
+        it = writes.end() - 1;
+    }
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        LLOG(LL_ERROR, "io_uring full, write to fd:%d dropped", fd);
+        return;
+    }
+    WriteOp* op = it->get();
+    op->busy    = true;
+    op->len     = len;
+    memcpy(op->buf, data, len);
+    io_uring_prep_write(sqe, fd, op->buf, len, 0);
+    io_uring_sqe_set_data64(sqe, uint64_t(op) | WRITE_TAG);
+    // frames must reach uinput in order
+    if (last_write) {
+        last_write->flags |= IOSQE_IO_LINK;
+    }
+    last_write = sqe;
+    queued     = true;
+}
+
+void Uring::submit() {
+    last_write = nullptr;
+    if (!queued) {
+        return;
+    }
+    queued = false;
+    if (int err = io_uring_submit(ring); err < 0) {
+        LLOG(LL_ERROR, "io_uring submit failed, %s", strerror(-err));
+    }
+}
+
+void Uring::finish_writes() {
+    submit();
+    // the writes submitted and not completed, the idle ops of the pool aside
+    auto in_flight = [this]() { return std::count_if(writes.begin(), writes.end(), [](auto& w) { return w->busy; }); };
+    uint64_t deadline = now_ns() + FINISH_TIMEOUT_NS;
+    while (size_t n = in_flight()) {
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            break;
+        }
+        // the completions of reads count too, it waits again for what is left
+        io_uring_cqe* cqe;
+        __kernel_timespec ts{.tv_sec = 0, .tv_nsec = long(deadline - now)};
+        io_uring_wait_cqes(ring, &cqe, n, &ts, nullptr);
+        // called while a device or the virtual device is being set up or torn
+        // down, the reads are done by the loop after it returned
+        while (io_uring_peek_cqe(ring, &cqe) == 0) {
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            int res       = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            if ((data & TAGS) == WRITE_TAG) {
+                write_done(data, res);
+            } else if (data != CANCEL_DATA) {
+                reinterpret_cast<ReadOp*>(data & ~TAGS)->in_flight = 0;
+                deferred.push_back({data, res});
+            }
+        }
+    }
+    if (size_t n = in_flight()) {
+        LLOG(LL_ERROR, "%zu io_uring writes still pending, dropped", n);
+    }
+    if (!deferred.empty()) {
+        uint64_t one = 1;
+        ::write(efd, &one, sizeof(one));
+    }
+}
+
+void Uring::write_done(uint64_t data, int res) {
+    auto op  = reinterpret_cast<WriteOp*>(data & ~TAGS);
+    op->busy = false;
+    if (res < 0) {
+        LLOG(LL_ERROR, "write uinput failed, %s", strerror(-res));
+    } else if (size_t(res) != op->len) {
+        LLOG(LL_ERROR, "short write to uinput, %d of %zu bytes", res, op->len);
+    }
+}
+
+void Uring::read_done(uint64_t data, int res) {
+    auto op   = reinterpret_cast<ReadOp*>(data & ~TAGS);
+    bool poll = data & POLL_TAG;
+    if (!op->cancelled && !poll && res != -EAGAIN) {
+        op->cb(res, op->buf);
+    }
+    if (op->cancelled) {
+        std::erase_if(reads, [&](auto& r) { return r.get() == op; });
+        return;
+    }
+    // a read shorter than asked took all that was queued, another one would
+    // only return -EAGAIN
+    if (!poll && res == -EAGAIN) {
+        op->polled = true;
+    }
+    bool drained = res == -EAGAIN || (op->polled && res > 0 && size_t(res) < op->len);
+    post(op, !poll && drained);
+}
+
+void Uring::reap() {
+    uint64_t n;
+    ::read(efd, &n, sizeof(n));
+    if (!deferred.empty()) {
+        // a callback may call finish_writes() and defer more
+        std::vector<Completion> done;
+        done.swap(deferred);
+        for (auto [data, res] : done) {
+            read_done(data, res);
+        }
+    }
+    io_uring_cqe* cqe;
+    while (io_uring_peek_cqe(ring, &cqe) == 0) {
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        int res       = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+        if (data == CANCEL_DATA) {
+            continue;
+        }
+        if ((data & TAGS) == WRITE_TAG) {
+            write_done(data, res);
+            continue;
+        }
+        reinterpret_cast<ReadOp*>(data & ~TAGS)->in_flight = 0;
+        read_done(data, res);
+    }
+}
+
+#else
+
+struct Uring::ReadOp {};
+struct Uring::WriteOp {};
+
+std::unique_ptr<Uring> Uring::create(EventLoop&) {
+    LLOG(LL_ERROR, "lanmai is built without io_uring");
+    return nullptr;
+}
+
+Uring::~Uring() {}
+Uring::ReadOp* Uring::read(int, size_t, ReadCallback) { return nullptr; }
+void Uring::cancel(ReadOp*) {}
+void Uring::write(int, const void*, size_t) {}
+void Uring::submit() {}
+void Uring::finish_writes() {}
+
+#endif
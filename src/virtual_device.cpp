@@ -0,0 +1,264 @@
+#include "virtual_device.h"
+#include "latency.h"
+#include "log.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <utility>
+
+VirtualDevice::VirtualDevice(EventLoop& loop, const std::vector<Mappers>& mappers)
+    : uring(loop.uring()), deadline_timer(loop, [this]() { expire(now_ns()); }) {
+    for (auto& m : mappers) {
+        slots.emplace_back(m);
+    }
+}
+
+VirtualDevice::~VirtualDevice() { close(); }
+
+bool VirtualDevice::open() { return init() && create(); }
+
+bool VirtualDevice::open(int fd) {
+    if (!init()) {
+        return false;
+    }
+    output.emplace(fd, uring);
+    return true;
+}
+
+bool VirtualDevice::init() {
+    dev = libevdev_new();
+    if (!dev) {
+        LLOG(LL_ERROR, "create dev failed");
+        return false;
+    }
+    libevdev_set_name(dev, "lanmai virtual keyboard");
+    // no EV_REP, the repeats come from the grabbed devices or RepeatMapper
+    libevdev_enable_event_type(dev, EV_KEY);
+    for (uint code = KEY_ESC; code < KEY_CNT; code++) {
+        // mouse, joystick, gamepad and tablet buttons would make it look like
+        // one, they go to the CloneDevice of their device
+        if (is_button(code)) {
+            continue;
+        }
+        libevdev_enable_event_code(dev, EV_KEY, code, nullptr);
+    }
+    libevdev_enable_event_type(dev, EV_MSC);
+    libevdev_enable_event_code(dev, EV_MSC, MSC_SCAN, nullptr);
+    return true;
+}
+
+bool VirtualDevice::create() {
+    uifd = ::open("/dev/uinput", O_RDWR | O_CLOEXEC);
+    if (uifd < 0) {
+        LLOG(LL_ERROR, "open uinput file failed");
+        return false;
+    }
+    if (libevdev_uinput_create_from_device(dev, uifd, &uidev) != 0) {
+        LLOG(LL_ERROR, "create uinput dev failed");
+        destroy();
+        return false;
+    }
+    output.emplace(uidev, uring);
+    LLOG(LL_INFO, "virtual device created: %s", libevdev_uinput_get_devnode(uidev));
+    return true;
+}
+
+static bool has_bit(const uint8_t* bits, uint n) { return bits[n / 8] & (1 << (n % 8)); }
+
+bool VirtualDevice::add_capabilities(int fd) {
+    if (!dev) {
+        return false;
+    }
+    // only what a keyboard has, axes and buttons go to the CloneDevice of their
+    // device. EV_REP would turn on the autorepeat of the kernel, EV_FF and
+    // EV_SND need their requests handled.
+    static constexpr std::pair<uint, uint> TYPES[] = {{EV_KEY, KEY_CNT}, {EV_MSC, MSC_CNT}, {EV_SW, SW_CNT},
+                                                      {EV_LED, LED_CNT}};
+    uint8_t types[(EV_CNT + 7) / 8] = {};
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0) {
+        return false;
+    }
+    uint added = 0;
+    for (auto [type, cnt] : TYPES) {
+        uint8_t codes[(KEY_CNT + 7) / 8] = {};
+        if (!has_bit(types, type) || ioctl(fd, EVIOCGBIT(type, sizeof(codes)), codes) < 0) {
+            continue;
+        }
+        for (uint code = 0; code < cnt; code++) {
+            if (!has_bit(codes, code) || has(type, code) || (type == EV_KEY && is_button(code))) {
+                continue;
+            }
+            libevdev_enable_event_code(dev, type, code, nullptr);
+            added++;
+        }
+    }
+    if (!added || !uidev) {
+        return true;
+    }
+    // uinput can't add them to a device, it's created again. The keys it has
+    // down are released before and pressed again on the new one, the mappers
+    // still hold them.
+    LLOG(LL_INFO, "%u new event codes, create the virtual device again", added);
+    KeyState down = output ? output->pressed() : KeyState{};
+    destroy();
+    if (!create()) {
+        return false;
+    }
+    down.for_each([&](uint code) { output->push(EV_KEY, code, 1); });
+    output->flush();
+    return true;
+}
+
+void VirtualDevice::destroy() {
+    // the last frames, e.g. the releases of closed devices, still go out
+    if (output && output->release_all()) {
+        output->flush();
+    }
+    if (output && uring) {
+        uring->finish_writes();
+    }
+    output.reset();
+    if (uidev) {
+        libevdev_uinput_destroy(uidev);
+        uidev = nullptr;
+    }
+    if (uifd >= 0) {
+        ::close(uifd);
+        uifd = -1;
+    }
+}
+
+void VirtualDevice::close() {
+    destroy();
+    libevdev_free(dev);
+    dev = nullptr;
+}
+
+void VirtualDevice::key(uint keymap, const input_event& input, CloneDevice* clone) {
+    auto& slot = slots[keymap];
+    if (input.code < KEY_CNT && input.value != 2) {
+        // a key held on several devices of the keymap is pressed by the first
+        // of them and released by the last
+        uint8_t& n = slot.down[input.code];
+        if (input.value) {
+            if (n++) {
+                return;
+            }
+            slot.held++;
+        } else if (n) {
+            if (--n) {
+                return;
+            }
+            slot.held--;
+        }
+    }
+    for (auto& mi : slot.pipeline.map(input)) {
+        if (clone && !has(mi.type, mi.code)) {
+            clone->push(mi);
+        } else {
+            push(mi);
+        }
+    }
+    arm_deadline_timer();
+}
+
+uint64_t VirtualDevice::deadline() const {
+    uint64_t res = 0;
+    for (auto& slot : slots) {
+        uint64_t d = slot.pipeline.deadline();
+        if (d && (!res || d < res)) {
+            res = d;
+        }
+    }
+    return res;
+}
+
+void VirtualDevice::arm_deadline_timer() {
+    uint64_t d = deadline();
+    if (d == armed_deadline) {
+        return;
+    }
+    armed_deadline = d;
+    if (d) {
+        deadline_timer.arm_at(d);
+    } else {
+        deadline_timer.disarm();
+    }
+}
+
+// a chord window, a double key timeout, a macro step or a repeat is due
+void VirtualDevice::expire(uint64_t now) {
+    armed_deadline = 0;
+    for (auto& slot : slots) {
+        for (auto& mi : slot.pipeline.expire(now)) {
+            push(mi);
+        }
+    }
+    flush();
+    arm_deadline_timer();
+}
+
+void VirtualDevice::push(const input_event& e) {
+    if (output) {
+        output->push(e);
+    }
+}
+
+bool VirtualDevice::flush() {
+    bool written = output && output->flush();
+    swap_pipelines();
+    return written;
+}
+
+void VirtualDevice::reload(const std::vector<Mappers>& mappers) {
+    for (uint i = 0; i < slots.size(); i++) {
+        slots[i].next_pipeline.emplace(mappers[i]);
+    }
+    swap_pipelines();
+}
+
+void VirtualDevice::reset(const std::vector<Mappers>& mappers) {
+    // what waits for a deadline, the rest of a macro included, is sent now
+    for (auto& slot : slots) {
+        while (!slot.pipeline.settled()) {
+            uint64_t d = slot.pipeline.deadline();
+            for (auto& mi : slot.pipeline.expire(d)) {
+                push(mi);
+            }
+            flush();
+        }
+    }
+    slots.clear();
+    for (auto& m : mappers) {
+        slots.emplace_back(m);
+    }
+    arm_deadline_timer();
+    release_stray();
+    LLOG(LL_INFO, "switched to the new keymaps");
+}
+
+void VirtualDevice::swap_pipelines() {
+    bool swapped = false;
+    for (auto& slot : slots) {
+        if (slot.next_pipeline && slot.quiescent()) {
+            slot.pipeline = std::move(*slot.next_pipeline);
+            slot.next_pipeline.reset();
+            swapped = true;
+            LLOG(LL_INFO, "switched to the new keymap");
+        }
+    }
+    if (swapped) {
+        release_stray();
+    }
+}
+
+void VirtualDevice::release_stray() {
+    if (!output || !output->any_down() ||
+        !std::all_of(slots.begin(), slots.end(), [](auto& slot) { return slot.quiescent(); })) {
+        return;
+    }
+    uint n = output->release_all();
+    output->flush();
+    LLOG(LL_INFO, "released %u keys no device holds", n);
+}
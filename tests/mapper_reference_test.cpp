@@ -0,0 +1,280 @@
+#include "keys.h"
+#include "latency.h"
+#include "mapper.h"
+#include "reference_mapper.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+// The compiled mappers against the ones they replaced, on random configs of
+// single, double and meta mappings and random typing over their keys: both
+// have to send the same events in the same order, releases and repeats
+// included. The old MetaMapper's release bookkeeping is the one difference,
+// see as_pressed(). Configs with layers and chords, which the old ones don't
+// have, only have to release every key, so do configs with a meta key and a
+// key sent by several source keys, which the old MetaMapper mixed up.
+
+static constexpr int CONFIGS = 4000;
+static constexpr int EVENTS  = 300;
+
+static const std::array<const char*, 15> NAMES = {"A", "B", "C", "D",     "E",        "F",   "G",       "H",
+                                                  "J", "K", "L", "SPACE", "CAPSLOCK", "ESC", "LEFTCTRL"};
+// keys no one types, each sent by a single mapping in the configs compared
+static const std::array<const char*, 40> TARGETS = {
+    "1",  "2",  "3",  "4",  "5",  "6",  "7",  "8",  "9",   "0",   "M",     "N",         "O",         "P",
+    "Q",  "R",  "S",  "T",  "U",  "V",  "W",  "X",  "Y",   "Z",   "F1",    "F2",        "F3",        "F4",
+    "F5", "F6", "F7", "F8", "F9", "F10", "TAB", "ENTER", "LEFTSHIFT", "RIGHTCTRL", "LEFTALT", "MINUS"};
+
+// with distinct, every key is sent by a single mapping and no key typed is sent
+static json random_config(std::mt19937& rng, bool layered, bool distinct) {
+    auto pick = [&]() {
+        // SPACE is the meta key of the plain configs
+        std::string name;
+        do {
+            name = NAMES[rng() % NAMES.size()];
+        } while (!layered && name == "SPACE");
+        return name;
+    };
+    std::vector<std::string> unused(TARGETS.begin(), TARGETS.end());
+    std::shuffle(unused.begin(), unused.end(), rng);
+    auto target = [&]() {
+        if (!distinct) {
+            return pick();
+        }
+        auto name = unused.back();
+        unused.pop_back();
+        return name;
+    };
+    json cfg;
+    json& m   = cfg["mapping"];
+    int metas = 0;
+    int n     = rng() % 8;
+    for (int i = 0; i < n; i++) {
+        auto name = "m" + std::to_string(i);
+        json e    = {{"enable", true}};
+        int type  = rng() % (layered ? 4 : 3);
+        if (type == 0) {
+            e["type"] = "single";
+            e["from"] = pick();
+            e["to"]   = target();
+        } else if (type == 1) {
+            e["type"]  = "double";
+            e["key"]   = pick();
+            e["click"] = target();
+            e["press"] = target();
+        } else if (type == 2) {
+            // the old MetaMapper takes a single meta key
+            if (!layered && metas++) {
+                continue;
+            }
+            e["type"] = layered && rng() % 2 ? "layer" : "meta";
+            e["key"]  = layered ? pick() : "SPACE";
+            if (e["type"] == "meta" || rng() % 2) {
+                e["click"] = target();
+            }
+            if (layered && rng() % 2) {
+                e["mode"] = "toggle";
+            }
+            if (layered && i > 0 && rng() % 2) {
+                auto parent = "m" + std::to_string(rng() % i);
+                if (m.contains(parent) && (m[parent]["type"] == "meta" || m[parent]["type"] == "layer")) {
+                    e["parent"] = parent;
+                }
+            }
+            json& mapping = e["mapping"];
+            for (int k = 1 + rng() % 4; k > 0; k--) {
+                mapping[pick()] = target();
+            }
+        } else {
+            json keys = json::array();
+            for (int k = 2 + rng() % 2; k > 0; k--) {
+                auto key = pick();
+                if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+                    keys.push_back(key);
+                }
+            }
+            if (keys.size() < 2) {
+                continue;
+            }
+            e["type"]    = "chord";
+            e["keys"]    = keys;
+            e["to"]      = target();
+            e["timeout"] = 30 + rng() % 50;
+        }
+        m[name] = e;
+    }
+    return cfg;
+}
+
+// random presses, releases and repeats of the last key pressed 20ms apart,
+// then the release of what is held
+static std::vector<input_event> random_typing(std::mt19937& rng) {
+    std::vector<input_event> res;
+    std::set<uint> held;
+    uint last = 0;
+    auto add = [&](uint64_t ms, uint code, int value) {
+        input_event e{};
+        e.time.tv_sec  = ms / 1000;
+        e.time.tv_usec = ms % 1000 * 1000;
+        e.type         = EV_KEY;
+        e.code         = code;
+        e.value        = value;
+        res.push_back(e);
+    };
+    for (int i = 0; i < EVENTS; i++) {
+        uint code = key_code(NAMES[rng() % NAMES.size()]);
+        if (held.count(last) && rng() % 4 == 0) {
+            add(i * 20, last, 2);
+        } else if (held.erase(code)) {
+            add(i * 20, code, 0);
+        } else {
+            held.insert(code);
+            add(i * 20, code, 1);
+            last = code;
+        }
+    }
+    for (uint code : held) {
+        add(100000, code, 0);
+    }
+    return res;
+}
+
+// whether the old mappers have everything cfg uses: single and double keys,
+// and one meta key neither toggled nor in another layer
+static bool old_kinds(const json& cfg) {
+    int metas = 0;
+    for (auto& [name, e] : cfg["mapping"].items()) {
+        auto type = e["type"].get<std::string>();
+        if (type == "meta" && !e.contains("mode") && !e.contains("parent") && !metas++) {
+            continue;
+        }
+        if (type != "single" && type != "double") {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool has_meta(const json& cfg) {
+    auto& m = cfg["mapping"];
+    return std::any_of(m.begin(), m.end(), [](auto& e) { return e["type"] == "meta"; });
+}
+
+// The old MetaMapper picked the code of a release or repeat by whether the
+// meta key was held then, not when the key was pressed, and on the release of
+// the meta key it released what it had mapped in the order of the first
+// presses, once per press. events, what it sent for input, is brought to what
+// the time of the press gives, in the order the keys were last pressed. down
+// has the keys pressed so far.
+static void as_pressed(const input_event& input, std::vector<input_event>& events, std::set<uint>& down) {
+    std::vector<input_event> res;
+    for (size_t i = 0; i < events.size(); i++) {
+        auto e     = events[i];
+        bool again = std::any_of(events.begin() + i + 1, events.end(),
+                                 [&](auto& next) { return next.code == e.code && next.value == 0; });
+        if (e.value == 0 && again) {
+            continue;
+        }
+        if (e.value != 1 && !down.count(e.code)) {
+            // the source key, held from before the meta key, or a key the meta
+            // key released already
+            if (!down.count(input.code)) {
+                continue;
+            }
+            e.code = input.code;
+        }
+        if (e.value == 1) {
+            down.insert(e.code);
+        } else if (e.value == 0) {
+            down.erase(e.code);
+        }
+        res.push_back(e);
+    }
+    events = res;
+}
+
+static void print(const char* what, const std::vector<input_event>& events) {
+    printf("%s:", what);
+    for (auto& e : events) {
+        printf(" %s:%d", key_name(e.code), e.value);
+    }
+    printf("\n");
+}
+
+int main() {
+    std::mt19937 rng(7);
+    int failed = 0;
+    for (int i = 0; i < CONFIGS && failed < 5; i++) {
+        bool layered  = i % 3 != 0;
+        bool distinct = i % 3 != 2;
+        json cfg      = random_config(rng, layered, distinct);
+        auto typing   = random_typing(rng);
+
+        Pipeline pipeline(get_mappers(cfg));
+        std::vector<input_event> out;
+        std::map<uint, bool> down;
+        auto emit = [&](const Events& events) {
+            for (auto& e : events) {
+                out.push_back(e);
+                if (e.value != 2) {
+                    down[e.code] = e.value;
+                }
+            }
+        };
+        for (auto& e : typing) {
+            while (uint64_t d = pipeline.deadline()) {
+                if (d > ns_of(e.time)) {
+                    break;
+                }
+                emit(pipeline.expire(d));
+            }
+            emit(pipeline.map(e));
+        }
+        for (auto [code, d] : down) {
+            if (d) {
+                printf("config %d: %s is still down\n%s\n", i, key_name(code), cfg.dump().c_str());
+                failed++;
+                break;
+            }
+        }
+        // the old MetaMapper tells the keys it sent apart by their code only
+        bool meta = has_meta(cfg);
+        if (!old_kinds(cfg) || (meta && !distinct)) {
+            continue;
+        }
+
+        auto [sm, dm, mm] = reference::get_mappers(cfg);
+        std::vector<input_event> expected;
+        std::set<uint> old_down;
+        for (auto& e : typing) {
+            for (auto& di : dm.map(sm.map(e))) {
+                auto mo = mm.map(di);
+                std::vector<input_event> events(mo.begin(), mo.end());
+                if (meta) {
+                    as_pressed(di, events, old_down);
+                }
+                expected.insert(expected.end(), events.begin(), events.end());
+            }
+        }
+        // uinput stamps the events itself, the times aren't compared
+        auto same = [](auto& a, auto& b) { return a.type == b.type && a.code == b.code && a.value == b.value; };
+        if (!std::equal(expected.begin(), expected.end(), out.begin(), out.end(), same)) {
+            printf("config %d: the events differ from the old mappers\n%s\n", i, cfg.dump().c_str());
+            print("old", expected);
+            print("new", out);
+            failed++;
+        }
+    }
+    if (failed) {
+        return 1;
+    }
+    printf("%d configs ok\n", CONFIGS);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "event_loop.h"
+#include "uring.h"
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+// The io_uring path of EventLoop over pipes: the reads get every byte in
+// order whether they fill their buffer or not, no read callback runs from
+// finish_writes(), the writes of a batch arrive in order, and a read cancelled
+// from its callback isn't called again. Built when liburing is found, skipped
+// when the kernel doesn't allow io_uring.
+
+static constexpr int SKIP = 77;
+static constexpr size_t READ_LEN = 64;
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("failed: %s\n", what);
+        failed++;
+    }
+}
+
+// runs the loop for ms
+static void run_for(EventLoop& loop, int ms) {
+    Timer stop(loop, [&]() { loop.stop(); });
+    stop.arm(std::chrono::milliseconds(ms));
+    loop.run();
+}
+
+int main() {
+    EventLoop loop;
+    if (!loop.use_io_uring()) {
+        printf("no io_uring, skipped\n");
+        return SKIP;
+    }
+    Uring* uring = loop.uring();
+    int in[2], out[2];
+    if (pipe2(in, O_NONBLOCK | O_CLOEXEC) < 0 || pipe2(out, O_NONBLOCK | O_CLOEXEC) < 0) {
+        return 1;
+    }
+
+    std::string got;
+    int calls      = 0;
+    bool finishing = false;
+    bool cancel    = false;
+    Uring::ReadOp* op = uring->read(in[0], READ_LEN, [&](int res, const char* data) {
+        calls++;
+        check(!finishing, "a read callback ran from finish_writes()");
+        if (res > 0) {
+            got.append(data, res);
+        }
+        if (cancel) {
+            uring->cancel(op);
+        }
+    });
+
+    // short reads, then one larger than the buffer
+    std::string sent;
+    for (int i = 0; i < 20; i++) {
+        std::string chunk(1 + i % 5, char('a' + i));
+        write(in[1], chunk.data(), chunk.size());
+        sent += chunk;
+        run_for(loop, 2);
+    }
+    std::string big(READ_LEN * 2 + 10, 'z');
+    write(in[1], big.data(), big.size());
+    sent += big;
+    run_for(loop, 10);
+    check(got == sent, "the reads didn't get the bytes written");
+
+    // a read completing while the writes are waited for is done by the loop
+    Timer finish(loop, [&]() {
+        write(in[1], "x", 1);
+        usleep(2000);
+        uring->write(out[1], "frame", 5);
+        finishing = true;
+        uring->finish_writes();
+        finishing = false;
+        char buf[8];
+        check(read(out[0], buf, sizeof(buf)) == 5, "finish_writes() didn't finish the write");
+    });
+    finish.arm(std::chrono::milliseconds(1));
+    run_for(loop, 10);
+    check(got == sent + "x", "the read done during finish_writes() was lost");
+
+    // the writes of a batch go out in order
+    Timer writes(loop, [&]() {
+        for (int i = 0; i < 100; i++) {
+            char c = char(i);
+            uring->write(out[1], &c, 1);
+        }
+    });
+    writes.arm(std::chrono::milliseconds(1));
+    run_for(loop, 10);
+    char buf[128];
+    ssize_t n = read(out[0], buf, sizeof(buf));
+    bool ordered = n == 100;
+    for (int i = 0; ordered && i < n; i++) {
+        ordered = buf[i] == char(i);
+    }
+    check(ordered, "the writes of a batch were reordered or lost");
+
+    // cancelled from its callback, it isn't called again
+    cancel = true;
+    write(in[1], "1", 1);
+    run_for(loop, 5);
+    int before = calls;
+    write(in[1], "2", 1);
+    run_for(loop, 5);
+    check(calls == before, "a cancelled read was called again");
+
+    if (failed) {
+        return 1;
+    }
+    printf("io_uring reads and writes ok\n");
+    return 0;
+}
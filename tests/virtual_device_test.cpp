@@ -0,0 +1,85 @@
+#include "virtual_device.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// A key held on the virtual device while a device with new event codes makes
+// it be created again is still held on the new one, and its release goes out.
+// Needs /dev/uinput, skipped without it.
+
+static constexpr int SKIP = 77;
+
+static void key(VirtualDevice& vdev, uint code, int value) {
+    input_event e{};
+    e.type  = EV_KEY;
+    e.code  = code;
+    e.value = value;
+    vdev.key(0, e);
+    vdev.flush();
+}
+
+static bool is_down(int fd, uint code) {
+    uint8_t bits[(KEY_CNT + 7) / 8] = {};
+    return ioctl(fd, EVIOCGKEY(sizeof(bits)), bits) >= 0 && bits[code / 8] & (1 << (code % 8));
+}
+
+int main() {
+    int uifd = open("/dev/uinput", O_RDWR | O_CLOEXEC);
+    if (uifd < 0) {
+        printf("no /dev/uinput, skipped\n");
+        return SKIP;
+    }
+    // a source with a switch, the virtual keyboard has none
+    libevdev* src = libevdev_new();
+    libevdev_set_name(src, "lanmai test switch");
+    libevdev_enable_event_code(src, EV_SW, SW_LID, nullptr);
+    libevdev_uinput* src_uidev = nullptr;
+    if (libevdev_uinput_create_from_device(src, uifd, &src_uidev) != 0) {
+        printf("can't create the source device\n");
+        return 1;
+    }
+    int src_fd = open(libevdev_uinput_get_devnode(src_uidev), O_RDONLY | O_CLOEXEC);
+
+    EventLoop loop;
+    VirtualDevice vdev(loop, {get_mappers(json::parse(R"({"mapping": {}})"))});
+    if (src_fd < 0 || !vdev.open()) {
+        printf("can't open the devices\n");
+        return 1;
+    }
+    key(vdev, KEY_LEFTCTRL, 1);
+    if (!vdev.add_capabilities(src_fd) || !vdev.has(EV_SW, SW_LID)) {
+        printf("the virtual device wasn't created again\n");
+        return 1;
+    }
+    int fd = open(vdev.devnode(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    int failed = 0;
+    if (fd < 0 || !is_down(fd, KEY_LEFTCTRL)) {
+        printf("LEFTCTRL isn't down on the new device\n");
+        failed++;
+    }
+    key(vdev, KEY_LEFTCTRL, 0);
+    bool released = false;
+    input_event e;
+    while (fd >= 0 && read(fd, &e, sizeof(e)) == sizeof(e)) {
+        released |= e.type == EV_KEY && e.code == KEY_LEFTCTRL && e.value == 0;
+    }
+    if (!released) {
+        printf("LEFTCTRL wasn't released\n");
+        failed++;
+    }
+
+    close(fd);
+    vdev.close();
+    libevdev_uinput_destroy(src_uidev);
+    libevdev_free(src);
+    close(src_fd);
+    close(uifd);
+    if (failed) {
+        return 1;
+    }
+    printf("held keys survive the virtual device being created again\n");
+    return 0;
+}
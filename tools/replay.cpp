@@ -0,0 +1,169 @@
+#include "common.h"
+#include "config.h"
+#include "key_state.h"
+#include "keys.h"
+#include "latency.h"
+#include "log.h"
+#include "mapper.h"
+#include "record.h"
+#include "third_party/argparse.hpp"
+#include <array>
+#include <bitset>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// Pushes a file written by `lanmai --record` through the mappers of a config,
+// offline, and writes what lanmai would have sent to uinput.
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser parser("lanmai-replay");
+
+    parser.add_argument("record").help("record file written by lanmai --record");
+    parser.add_argument("-c", "--config")
+        .help("config file path, default: /etc/lanmai.json")
+        .default_value(std::string("/etc/lanmai.json"));
+    parser.add_argument("-o", "--output")
+        .help("write the mapped events to this record file instead of printing them")
+        .default_value(std::string());
+    parser.add_argument("--pace")
+        .help("replay with the original timing instead of as fast as possible")
+        .default_value(false)
+        .implicit_value(true);
+    parser.add_argument("-q", "--quiet")
+        .help("only print the summary")
+        .default_value(false)
+        .implicit_value(true);
+
+    try {
+        parser.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        printf("%s\n", err.what());
+        printf("%s\n", parser.help().str().c_str());
+        exit(1);
+    }
+
+    RecordReader reader;
+    if (!reader.open(parser.get<std::string>("record"))) {
+        return 1;
+    }
+    Recorder writer;
+    auto output = parser.get<std::string>("-o");
+    if (!output.empty() && !writer.open(output)) {
+        return 1;
+    }
+    bool pace  = parser.get<bool>("--pace");
+    bool quiet = parser.get<bool>("-q");
+
+    Mappers mappers = get_mappers(readConfig(parser.get<std::string>("-c")));
+    // all devices share the mappers and the output frame, as in lanmai
+    Pipeline pipeline(mappers);
+    bool frame_dirty = false;
+    // the keys lanmai pressed, its Output drops the redundant events
+    KeyState sent;
+
+    auto emit = [&](uint8_t device, const input_event& e) {
+        if (writer.is_open()) {
+            writer.write(device, e);
+        } else if (!quiet) {
+            const char* name = e.type == EV_KEY ? key_name(e.code) : nullptr;
+            printf("%ld.%06ld dev:%d type:%d code:%d %s value:%d\n", e.time.tv_sec, e.time.tv_usec, device, e.type,
+                   e.code, name ? name : "", e.value);
+        }
+    };
+
+    uint64_t events = 0, frames = 0, out_events = 0, map_ns = 0;
+    // what the mappers sent, unless redundant
+    auto send = [&](uint8_t device, const input_event& e) {
+        if (sent.apply(e)) {
+            emit(device, e);
+            frame_dirty = true;
+            out_events++;
+        }
+    };
+    uint64_t first = 0, start = now_ns();
+    std::array<bool, 256> dropping{};
+    // the keys of each device as the mappers saw them, and the devices holding
+    // each key, it's pressed with the first of them and released with the last
+    std::vector<std::bitset<KEY_CNT>> down(256);
+    std::array<uint8_t, KEY_CNT> held_by{};
+    RecordEvent re;
+    while (reader.next(re)) {
+        if (pace) {
+            if (events == 0) {
+                first = re.time_ns;
+            }
+            uint64_t at = start + (re.time_ns > first ? re.time_ns - first : 0);
+            timespec ts{.tv_sec = time_t(at / 1000000000), .tv_nsec = long(at % 1000000000)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        }
+        events++;
+        // what the deadline timer of lanmai would have sent by now
+        while (pipeline.deadline() && re.time_ns >= pipeline.deadline()) {
+            input_event syn{};
+            for (auto& e : pipeline.expire(pipeline.deadline())) {
+                send(re.device, e);
+                syn.time = e.time;
+            }
+            if (frame_dirty) {
+                syn.type = EV_SYN;
+                syn.code = SYN_REPORT;
+                emit(re.device, syn);
+                frame_dirty = false;
+                frames++;
+            }
+        }
+
+        input_event input = re.to_input();
+        // lanmai dropped these, the resync it did follows them in the record
+        if (input.type == EV_SYN && input.code == SYN_DROPPED) {
+            dropping[re.device] = true;
+            continue;
+        }
+        if (dropping[re.device]) {
+            dropping[re.device] = !(input.type == EV_SYN && input.code == SYN_REPORT);
+            continue;
+        }
+        // the same framing as Output: one SYN_REPORT per non-empty frame
+        if (input.type == EV_SYN && input.code == SYN_REPORT) {
+            if (frame_dirty) {
+                emit(re.device, input);
+                frame_dirty = false;
+                frames++;
+            }
+            continue;
+        }
+        if (input.type != EV_KEY) {
+            emit(re.device, input);
+            frame_dirty = true;
+            out_events++;
+            continue;
+        }
+        // lanmai drops a press or release that doesn't change a key, e.g. one
+        // read along with a resync that did it already
+        if (input.code < KEY_CNT && input.value != 2) {
+            if (down[re.device][input.code] == bool(input.value)) {
+                continue;
+            }
+            down[re.device][input.code] = input.value;
+            uint8_t& n                  = held_by[input.code];
+            if (input.value ? n++ : --n) {
+                continue;
+            }
+        }
+        uint64_t begin     = now_ns();
+        const Events& outs = pipeline.map(input);
+        map_ns += now_ns() - begin;
+        for (auto& e : outs) {
+            send(re.device, e);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    fprintf(stderr, "events: %lu, frames out: %lu, events out: %lu\n", events, frames, out_events);
+    if (events) {
+        fprintf(stderr, "total: %.1f ns/event, mappers: %.1f ns/event\n", double(elapsed) / events,
+                double(map_ns) / events);
+    }
+    return 0;
+}